@@ -1,66 +1,440 @@
 #include "audio.h"
-#include "tsf.h"
+#include "synth.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <limits.h>
 
-extern const unsigned char soundfont_sf2[];
-extern const unsigned int soundfont_sf2_len;
+// Font image generated from the soundfont at build time (see src/sfimage.c)
+extern const unsigned char soundfont_image[];
+extern const unsigned int soundfont_image_len;
 
-static tsf *g_synth = NULL;
+struct sh_engine
+{
+    SynthFont *font;
+    // External font file the font points into, NULL for the embedded image
+    void *mapping;
+    size_t mapping_size;
+    // Font tables mapped from the shared cache, NULL for a private load
+    void *shared;
+    size_t shared_size;
+    // Voice pool size of each encoder's synth, and the output level below
+    // which its voices are culled (0 for none)
+    int max_voices;
+    float cull_level;
+    int render_engine;
+    int channel_rate[AUDIO_CHANNELS];
+};
+
+struct sh_encoder
+{
+    sh_engine *engine;
+    Synth *synth;
+    AudioStats stats;
+    // The same counters since the last reset, and the synth's counters then
+    AudioStats job;
+    SynthVoiceStats job_base;
+    // Preset last selected on each channel (-1 for none), so repeated notes
+    // of one instrument do not change the channel's preset again
+    int channel_program[AUDIO_CHANNELS];
+};
+
+static void forget_programs(sh_encoder *enc)
+{
+    for (int c = 0; c < AUDIO_CHANNELS; c++)
+        enc->channel_program[c] = -1;
+}
+
+static void *map_file(const char *path, size_t *size, struct stat *st)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    void *data = MAP_FAILED;
+    if (fstat(fd, st) == 0 && st->st_size > 0)
+        data = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    *size = (size_t)st->st_size;
+    return data;
+}
+
+static uint64_t fnv1a(const uint64_t *key, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const unsigned char *bytes = (const unsigned char *)key;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+#define FONT_CACHE_PREFIX "stringheat-"
+
+// Shared cache segments are named after the font file (device and inode)
+// and then its version and the image format, so an edited font or a
+// different build never matches a stale segment, and the segments of one
+// font file share a prefix.
+static void font_cache_name(const struct stat *st, char *name, size_t size)
+{
+    uint64_t file[] = {(uint64_t)st->st_dev, (uint64_t)st->st_ino};
+    uint64_t version[] = {(uint64_t)st->st_size, (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec,
+                          SYNTH_IMAGE_VERSION, sizeof(SynthRegion)};
+    snprintf(name, size, "/" FONT_CACHE_PREFIX "%016llx-%016llx", (unsigned long long)fnv1a(file, sizeof(file)),
+             (unsigned long long)fnv1a(version, sizeof(version)));
+}
+
+// Unlinks this user's segments for the same font file under any other
+// version: they can never match again. Processes that attached one keep
+// their mapping; one still being written (locked) is left for next time.
+static void unlink_stale_fonts(const char *name)
+{
+    DIR *dir = opendir("/dev/shm");
+    if (!dir)
+        return;
+    // name is "/" FONT_CACHE_PREFIX "<file>-<version>"
+    size_t file_len = strlen(FONT_CACHE_PREFIX) + 17;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (strncmp(entry->d_name, name + 1, file_len) != 0 || strcmp(entry->d_name, name + 1) == 0)
+            continue;
+        char stale_name[NAME_MAX + 2];
+        snprintf(stale_name, sizeof(stale_name), "/%s", entry->d_name);
+        int fd = shm_open(stale_name, O_RDONLY, 0);
+        if (fd < 0)
+            continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_uid == geteuid() && flock(fd, LOCK_EX | LOCK_NB) == 0)
+            shm_unlink(stale_name);
+        close(fd);
+    }
+    closedir(dir);
+}
 
-void audio_init(const char *soundfont_path)
+// Maps the tables another process published for this font. A segment that
+// is still being written is waited for (its writer holds an exclusive lock).
+// Segment names are predictable, so only segments this user created are
+// trusted; synth_font_load_tables() still checks the tables' bounds against
+// the file's pool.
+static SynthFont *attach_shared_font(sh_engine *engine, const char *name, const int16_t *samples,
+                                     uint32_t sample_count)
 {
-    (void)soundfont_path;
-    g_synth = tsf_load_memory(soundfont_sf2, soundfont_sf2_len);
-    if (!g_synth)
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (flock(fd, LOCK_SH) == 0 && fstat(fd, &st) == 0 && st.st_uid == geteuid() && st.st_size > 0)
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    SynthFont *font = synth_font_load_tables(data, (size_t)st.st_size, samples, sample_count);
+    if (!font)
     {
-        fprintf(stderr, "Failed to load soundfont\n");
-        exit(1);
+        munmap(data, (size_t)st.st_size);
+        return NULL;
     }
-    tsf_set_output(g_synth, TSF_STEREO_INTERLEAVED, 44100, 0.0f);
+    engine->shared = data;
+    engine->shared_size = (size_t)st.st_size;
+    return font;
 }
 
-void audio_cleanup(void)
+// Publishes font's tables under name. Failing is harmless: the next process
+// parses privately and tries again.
+static void publish_shared_font(const SynthFont *font, const char *name)
 {
-    if (g_synth)
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        // An unlocked segment of ours that did not attach was left behind
+        // by a writer that died; replace it. Other users' segments are left
+        // alone, and this process keeps its private parse.
+        int stale = shm_open(name, O_RDWR, 0);
+        struct stat st;
+        if (stale >= 0 && fstat(stale, &st) == 0 && st.st_uid == geteuid() && flock(stale, LOCK_EX | LOCK_NB) == 0)
+        {
+            shm_unlink(name);
+            fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        }
+        if (stale >= 0)
+            close(stale);
+    }
+    if (fd < 0)
+        return;
+
+    flock(fd, LOCK_EX);
+    unlink_stale_fonts(name);
+    FILE *out = fdopen(fd, "wb");
+    if (!out)
     {
-        tsf_close(g_synth);
-        g_synth = NULL;
+        shm_unlink(name);
+        close(fd);
+        return;
     }
+    if (!synth_font_write_image(font, out, SYNTH_IMAGE_TABLES) || fflush(out) != 0)
+        shm_unlink(name);
+    fclose(out);
+}
+
+// Font tables for an external SF2 through the shared cache; the samples
+// always come from the file mapping, which the page cache already shares.
+static SynthFont *load_shared_font(sh_engine *engine, const struct stat *st)
+{
+    uint32_t sample_count;
+    const int16_t *samples = synth_sf2_samples(engine->mapping, engine->mapping_size, &sample_count);
+    if (!samples)
+        return synth_font_load_sf2(engine->mapping, engine->mapping_size);
+
+    char name[64];
+    font_cache_name(st, name, sizeof(name));
+    SynthFont *font = attach_shared_font(engine, name, samples, sample_count);
+    if (font)
+        return font;
+
+    font = synth_font_load_sf2(engine->mapping, engine->mapping_size);
+    if (font)
+        publish_shared_font(font, name);
+    return font;
+}
+
+sh_engine *audio_init(const char *soundfont_path)
+{
+    AudioOptions options = {soundfont_path, 0, 0, AUDIO_CULL_OFF, AUDIO_ENGINE_VOICES};
+    return audio_init_with(&options);
+}
+
+sh_engine *audio_init_with(const AudioOptions *options)
+{
+    if (!(options->cull_threshold >= 0.0f))
+        return NULL;
+    sh_engine *engine = malloc(sizeof(sh_engine));
+    if (!engine)
+        return NULL;
+    engine->mapping = NULL;
+    engine->mapping_size = 0;
+    engine->shared = NULL;
+    engine->shared_size = 0;
+    engine->max_voices = options->max_voices;
+    engine->cull_level = options->cull_threshold / 32768.0f;
+    engine->render_engine = options->engine;
+    for (int c = 0; c < AUDIO_CHANNELS; c++)
+        engine->channel_rate[c] = options->channel_rate[c] ? options->channel_rate[c] : 1;
+
+    if (!options->soundfont_path)
+    {
+        // The image is already parsed: presets, regions and samples are used
+        // in place from the binary's read-only data.
+        engine->font = synth_font_load_image(soundfont_image, soundfont_image_len);
+    }
+    else
+    {
+        // SF2 files (or images from sfimage) are mapped, not read: only the
+        // preset tables are parsed, samples are paged in as voices play them
+        // and the page cache shares them between processes.
+        struct stat st;
+        engine->mapping = map_file(options->soundfont_path, &engine->mapping_size, &st);
+        engine->font = NULL;
+        if (engine->mapping && engine->mapping_size >= 4 && memcmp(engine->mapping, "SHSF", 4) == 0)
+            engine->font = synth_font_load_image(engine->mapping, engine->mapping_size);
+        else if (engine->mapping && options->shared_cache)
+            engine->font = load_shared_font(engine, &st);
+        else if (engine->mapping)
+            engine->font = synth_font_load_sf2(engine->mapping, engine->mapping_size);
+    }
+
+    if (!engine->font)
+    {
+        if (engine->mapping)
+            munmap(engine->mapping, engine->mapping_size);
+        free(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+void audio_cleanup(sh_engine *engine)
+{
+    if (!engine)
+        return;
+    synth_font_free(engine->font);
+    if (engine->mapping)
+        munmap(engine->mapping, engine->mapping_size);
+    if (engine->shared)
+        munmap(engine->shared, engine->shared_size);
+    free(engine);
+}
+
+sh_encoder *audio_encoder_create(sh_engine *engine)
+{
+    if (!engine)
+        return NULL;
+    sh_encoder *enc = malloc(sizeof(sh_encoder));
+    if (!enc)
+        return NULL;
+
+    // The synth only reads the engine's font and owns voices and channel state
+    enc->engine = engine;
+    enc->synth = synth_create(engine->font, 44100.0f, engine->max_voices);
+    memset(&enc->stats, 0, sizeof(enc->stats));
+    memset(&enc->job, 0, sizeof(enc->job));
+    memset(&enc->job_base, 0, sizeof(enc->job_base));
+    forget_programs(enc);
+    if (!enc->synth)
+    {
+        free(enc);
+        return NULL;
+    }
+    synth_set_cull_level(enc->synth, engine->cull_level);
+    int ok = engine->render_engine != AUDIO_ENGINE_BANK || synth_set_engine(enc->synth, SYNTH_ENGINE_BANK);
+    for (int c = 0; ok && c < AUDIO_CHANNELS; c++)
+        ok = synth_set_channel_rate(enc->synth, c, engine->channel_rate[c]);
+    if (!ok)
+    {
+        synth_destroy(enc->synth);
+        free(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+void audio_encoder_stats(const sh_encoder *enc, AudioStats *stats)
+{
+    SynthVoiceStats voices;
+    synth_voice_stats(enc->synth, &voices);
+    *stats = enc->stats;
+    stats->voice_frames = voices.voice_frames;
+    stats->voices_stolen = voices.stolen;
+    stats->voices_culled = voices.culled;
+    memcpy(stats->voice_kernels, voices.kernel_voices, sizeof(stats->voice_kernels));
+}
+
+void audio_encoder_job_stats(const sh_encoder *enc, AudioStats *stats)
+{
+    SynthVoiceStats voices;
+    synth_voice_stats(enc->synth, &voices);
+    *stats = enc->job;
+    stats->voice_frames = voices.voice_frames - enc->job_base.voice_frames;
+    stats->voices_stolen = voices.stolen - enc->job_base.stolen;
+    stats->voices_culled = voices.culled - enc->job_base.culled;
+    for (int k = 0; k < AUDIO_VOICE_KERNELS; k++)
+        stats->voice_kernels[k] = voices.kernel_voices[k] - enc->job_base.kernel_voices[k];
+}
+
+void audio_stats_add(AudioStats *total, const AudioStats *stats)
+{
+    total->render_calls += stats->render_calls;
+    total->frames_rendered += stats->frames_rendered;
+    total->voice_frames += stats->voice_frames;
+    if (stats->peak_voices > total->peak_voices)
+        total->peak_voices = stats->peak_voices;
+    total->voices_stolen += stats->voices_stolen;
+    total->voices_culled += stats->voices_culled;
+    for (int k = 0; k < AUDIO_VOICE_KERNELS; k++)
+        total->voice_kernels[k] += stats->voice_kernels[k];
+}
+
+_Static_assert(AUDIO_VOICE_KERNELS == SYNTH_VOICE_KERNELS, "kernel counts out of step");
+
+const char *audio_voice_kernel_name(int kernel)
+{
+    return synth_voice_kernel_name(kernel);
+}
+
+int audio_encoder_reset(sh_encoder *enc)
+{
+    // No voices and default channels, exactly like a new encoder
+    synth_reset(enc->synth);
+    forget_programs(enc);
+    memset(&enc->job, 0, sizeof(enc->job));
+    synth_voice_stats(enc->synth, &enc->job_base);
+    return 1;
+}
+
+void audio_encoder_destroy(sh_encoder *enc)
+{
+    if (!enc)
+        return;
+    synth_destroy(enc->synth);
+    free(enc);
 }
 
-void audio_note_on(int channel, int preset, int note, float velocity)
+void audio_note_on(sh_encoder *enc, int channel, int preset, int note, float velocity)
 {
-    if (!g_synth)
+    if (!enc || !enc->synth)
         return;
 
     // For channel 9 (drums), always use bank 128 (drum kit)
     // For other channels, use bank 0 (melodic instruments)
     int is_drum = (channel == 9);
-    tsf_channel_set_bank_preset(g_synth, channel, is_drum ? 128 : 0, preset);
-    tsf_channel_note_on(g_synth, channel, note, velocity);
+    if (channel < 0 || channel >= AUDIO_CHANNELS || enc->channel_program[channel] != preset)
+    {
+        synth_channel_set_preset(enc->synth, channel, is_drum ? 128 : 0, preset);
+        if (channel >= 0 && channel < AUDIO_CHANNELS)
+            enc->channel_program[channel] = preset;
+    }
+    synth_channel_note_on(enc->synth, channel, note, velocity);
+}
+
+void audio_note_off(sh_encoder *enc, int channel, int note)
+{
+    if (!enc || !enc->synth)
+        return;
+    synth_channel_note_off(enc->synth, channel, note);
 }
 
-void audio_note_off(int channel, int note)
+void audio_prefetch(sh_encoder *enc, int channel, int preset, int note)
 {
-    if (!g_synth)
+    if (!enc)
         return;
-    tsf_channel_note_off(g_synth, channel, note);
+    synth_font_prefetch(enc->engine->font, channel == 9 ? 128 : 0, preset, note);
 }
 
-void audio_render_samples(int16_t *buffer, size_t frames)
+void audio_render_samples(sh_encoder *enc, int16_t *buffer, size_t frames)
 {
-    if (!g_synth)
+    if (!enc || !enc->synth)
         return;
-    tsf_render_short(g_synth, buffer, frames, 0);
+    // Notes start between render calls, so the voice count peaks here
+    uint32_t voices = (uint32_t)synth_active_voices(enc->synth);
+    AudioStats *counters[] = {&enc->stats, &enc->job};
+    for (int i = 0; i < 2; i++)
+    {
+        counters[i]->render_calls++;
+        counters[i]->frames_rendered += frames;
+        if (voices > counters[i]->peak_voices)
+            counters[i]->peak_voices = voices;
+    }
+    synth_render_short(enc->synth, buffer, frames);
+}
+
+// The metadata chunk is "shXX": seed hash, text length, XOR-encoded text.
+// Layout 2 appends a version word, which decoders that only read the first
+// three fields never see, and moves the chunk in front of the PCM data.
+static uint32_t metadata_size(const char *text, int layout)
+{
+    return 8 + (uint32_t)strlen(text) + (layout >= AUDIO_WAV_V2 ? 4 : 0);
 }
 
-int audio_write_wav(const char *text, uint32_t seed_hash, AudioData *data)
+static int write_metadata(FILE *out, const char *text, uint32_t seed_hash, int layout)
 {
     size_t text_len = strlen(text);
-    size_t meta_size = 8 + text_len;
-    uint8_t *meta = malloc(meta_size);
+    if (text_len > AUDIO_MAX_TEXT)
+        return 0;
+    uint32_t meta_size = metadata_size(text, layout);
+    // Chunks in the middle of a RIFF file must be word aligned
+    size_t pad = (layout >= AUDIO_WAV_V2) ? (meta_size & 1) : 0;
+    uint8_t *meta = calloc(meta_size + pad, 1);
     if (!meta)
         return 0;
 
@@ -73,16 +447,33 @@ int audio_write_wav(const char *text, uint32_t seed_hash, AudioData *data)
         meta[8 + i] = text[i] ^ ((seed_hash >> ((i % 4) * 8)) & 0xFF);
     }
 
-    uint32_t data_size = (uint32_t)(data->frame_count * 4);
-    uint32_t file_size = 36 + data_size + 8 + meta_size;
-
-    FILE *out = fopen("/dev/stdout", "wb");
-    if (!out)
+    if (layout >= AUDIO_WAV_V2)
     {
-        free(meta);
-        return 0;
+        uint32_t version = AUDIO_WAV_V2;
+        memcpy(meta + 8 + text_len, &version, 4);
     }
 
+    fwrite("shXX", 1, 4, out);
+    fwrite(&meta_size, 4, 1, out);
+    fwrite(meta, 1, meta_size + pad, out);
+
+    free(meta);
+    return !ferror(out);
+}
+
+int audio_write_wav_header(FILE *out, size_t frame_count, const char *text, uint32_t seed_hash, int layout)
+{
+    if (strlen(text) > AUDIO_MAX_TEXT)
+        return 0;
+    // RIFF sizes are 32-bit: a track whose file would pass 4 GiB is refused
+    // rather than written with wrapped sizes
+    uint32_t meta_size = metadata_size(text, layout);
+    uint64_t riff_size = 36 + 8 + (uint64_t)meta_size + (meta_size & 1);
+    if (frame_count > (UINT32_MAX - riff_size) / 4)
+        return 0;
+    uint32_t data_size = (uint32_t)(frame_count * 4);
+    uint32_t file_size = 36 + data_size + 8 + meta_size + (layout >= AUDIO_WAV_V2 ? (meta_size & 1) : 0);
+
     fwrite("RIFF", 1, 4, out);
     fwrite(&file_size, 4, 1, out);
     fwrite("WAVE", 1, 4, out);
@@ -103,81 +494,215 @@ int audio_write_wav(const char *text, uint32_t seed_hash, AudioData *data)
     fwrite(&block_align, 2, 1, out);
     fwrite(&bits, 2, 1, out);
 
+    if (layout >= AUDIO_WAV_V2 && !write_metadata(out, text, seed_hash, layout))
+        return 0;
+
     fwrite("data", 1, 4, out);
     fwrite(&data_size, 4, 1, out);
-    fwrite(data->buffer, 1, data_size, out);
+    return !ferror(out);
+}
 
-    fwrite("shXX", 1, 4, out);
-    fwrite(&meta_size, 4, 1, out);
-    fwrite(meta, 1, meta_size, out);
+int audio_write_wav_trailer(FILE *out, const char *text, uint32_t seed_hash, int layout)
+{
+    if (layout >= AUDIO_WAV_V2)
+        return 1;
+    return write_metadata(out, text, seed_hash, layout);
+}
 
-    fclose(out);
-    free(meta);
+int audio_write_wav(FILE *out, const char *text, uint32_t seed_hash, AudioData *data)
+{
+    if (!audio_write_wav_header(out, data->frame_count, text, seed_hash, AUDIO_WAV_V2))
+        return 0;
+    fwrite(data->buffer, 4, data->frame_count, out);
+    if (!audio_write_wav_trailer(out, text, seed_hash, AUDIO_WAV_V2))
+        return 0;
+    return fflush(out) == 0 && !ferror(out);
+}
+
+// Metadata chunks are tiny; anything larger is not ours
+#define MAX_META_SIZE (8 + AUDIO_MAX_TEXT + 4)
+
+typedef struct
+{
+    int fd;
+    int seekable;
+    uint64_t pos;
+    uint64_t bytes_read;
+} ChunkReader;
+
+// Reads exactly size bytes at the current position
+static int chunk_read(ChunkReader *r, void *buf, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = r->seekable ? pread(r->fd, (uint8_t *)buf + done, size - done, r->pos + done)
+                                : read(r->fd, (uint8_t *)buf + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        done += n;
+        r->bytes_read += n;
+    }
+    r->pos += size;
     return 1;
 }
 
-char *audio_read_metadata(const char *filename, uint32_t seed_hash)
+// Seekable inputs just move the position; pipes are drained through a small
+// buffer so memory stays bounded.
+static int chunk_skip(ChunkReader *r, uint64_t size)
 {
-    FILE *f = fopen(filename, "rb");
-    if (!f)
-        return NULL;
+    if (r->seekable)
+    {
+        r->pos += size;
+        return 1;
+    }
+
+    uint8_t discard[65536];
+    while (size > 0)
+    {
+        size_t n = size > sizeof(discard) ? sizeof(discard) : (size_t)size;
+        if (!chunk_read(r, discard, n))
+            return 0;
+        size -= n;
+    }
+    return 1;
+}
+
+static int decode_metadata(const uint8_t *meta, uint32_t meta_size, uint32_t seed_hash, char **text_out)
+{
+    if (meta_size < 8)
+        return AUDIO_DECODE_CORRUPT;
+
+    uint32_t stored_hash;
+    memcpy(&stored_hash, meta, 4);
+    if (stored_hash != seed_hash)
+        return AUDIO_DECODE_WRONG_SEED;
 
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    uint32_t text_len;
+    memcpy(&text_len, meta + 4, 4);
+    if (text_len > AUDIO_MAX_TEXT || 8 + text_len > meta_size)
+        return AUDIO_DECODE_CORRUPT;
 
-    uint8_t *data = malloc(fsize);
-    if (!data)
+    // Layout 2 files carry a version word after the text; legacy files end
+    // with the text.
+    if (meta_size >= 8 + text_len + 4)
     {
-        fclose(f);
-        return NULL;
+        uint32_t version;
+        memcpy(&version, meta + 8 + text_len, 4);
+        if (version > AUDIO_WAV_V2)
+            return AUDIO_DECODE_CORRUPT;
+    }
+
+    char *text = malloc(text_len + 1);
+    if (!text)
+        return AUDIO_DECODE_IO_ERROR;
+
+    for (uint32_t j = 0; j < text_len; j++)
+    {
+        text[j] = meta[8 + j] ^ ((seed_hash >> ((j % 4) * 8)) & 0xFF);
     }
-    fread(data, 1, fsize, f);
-    fclose(f);
+    text[text_len] = '\0';
+    *text_out = text;
+    return AUDIO_DECODE_OK;
+}
 
-    for (long i = 0; i < fsize - 16; i++)
+// Walks the RIFF chunk list reading only chunk headers and the metadata
+// chunk; the PCM payload is seeked over (or drained, for pipes). Layout 2
+// files are decoded from their first few hundred bytes, so a truncated or
+// still-uploading file works too.
+static int read_metadata_fd(ChunkReader *r, uint32_t seed_hash, char **text)
+{
+    uint8_t header[12];
+
+    ssize_t n = pread(r->fd, header, sizeof(header), 0);
+    if (n == (ssize_t)sizeof(header))
+    {
+        r->seekable = 1;
+        r->pos = sizeof(header);
+        r->bytes_read = sizeof(header);
+    }
+    else if (n < 0 && errno == ESPIPE)
+    {
+        if (!chunk_read(r, header, sizeof(header)))
+            return AUDIO_DECODE_NOT_WAV;
+    }
+    else
     {
-        if (data[i] == 's' && data[i + 1] == 'h' && data[i + 2] == 'X' && data[i + 3] == 'X')
+        return n < 0 ? AUDIO_DECODE_IO_ERROR : AUDIO_DECODE_NOT_WAV;
+    }
+
+    if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+        return AUDIO_DECODE_NOT_WAV;
+
+    uint8_t chunk[8];
+    while (chunk_read(r, chunk, sizeof(chunk)))
+    {
+        uint32_t chunk_size;
+        memcpy(&chunk_size, chunk + 4, 4);
+
+        if (memcmp(chunk, "shXX", 4) == 0)
         {
-            uint32_t chunk_size;
-            memcpy(&chunk_size, data + i + 4, 4);
-
-            if (i + 8 + chunk_size > fsize)
-                break;
-
-            uint32_t stored_hash;
-            memcpy(&stored_hash, data + i + 8, 4);
-
-            if (stored_hash != seed_hash)
-            {
-                free(data);
-                return NULL;
-            }
-
-            uint32_t text_len;
-            memcpy(&text_len, data + i + 12, 4);
-
-            if (text_len > 10000 || i + 16 + text_len > fsize)
-                break;
-
-            char *text = malloc(text_len + 1);
-            if (!text)
-            {
-                free(data);
-                return NULL;
-            }
-
-            for (uint32_t j = 0; j < text_len; j++)
-            {
-                text[j] = data[i + 16 + j] ^ ((seed_hash >> ((j % 4) * 8)) & 0xFF);
-            }
-            text[text_len] = '\0';
-
-            free(data);
-            return text;
+            if (chunk_size > MAX_META_SIZE)
+                return AUDIO_DECODE_CORRUPT;
+            uint8_t meta[MAX_META_SIZE];
+            if (!chunk_read(r, meta, chunk_size))
+                return AUDIO_DECODE_CORRUPT;
+            return decode_metadata(meta, chunk_size, seed_hash, text);
         }
+
+        // RIFF chunks are word aligned
+        if (!chunk_skip(r, (uint64_t)chunk_size + (chunk_size & 1)))
+            break;
     }
 
-    free(data);
-    return NULL;
+    return AUDIO_DECODE_NO_METADATA;
+}
+
+int audio_decode_file(const char *filename, uint32_t seed_hash, char **text, uint64_t *bytes_read)
+{
+    ChunkReader r = {STDIN_FILENO, 0, 0, 0};
+    *text = NULL;
+
+    if (strcmp(filename, "-") != 0)
+    {
+        r.fd = open(filename, O_RDONLY);
+        if (r.fd < 0)
+            return AUDIO_DECODE_IO_ERROR;
+    }
+
+    int status = read_metadata_fd(&r, seed_hash, text);
+
+    if (r.fd != STDIN_FILENO)
+        close(r.fd);
+    if (bytes_read)
+        *bytes_read = r.bytes_read;
+    return status;
+}
+
+const char *audio_decode_status_name(int status)
+{
+    switch (status)
+    {
+    case AUDIO_DECODE_OK:
+        return "ok";
+    case AUDIO_DECODE_IO_ERROR:
+        return "io_error";
+    case AUDIO_DECODE_NOT_WAV:
+        return "not_wav";
+    case AUDIO_DECODE_NO_METADATA:
+        return "no_metadata";
+    case AUDIO_DECODE_WRONG_SEED:
+        return "wrong_seed";
+    default:
+        return "corrupt";
+    }
+}
+
+char *audio_read_metadata(const char *filename, uint32_t seed_hash)
+{
+    char *text;
+    audio_decode_file(filename, seed_hash, &text, NULL);
+    return text;
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 
 typedef struct
 {
@@ -11,12 +12,130 @@ typedef struct
     int sample_rate;
 } AudioData;
 
-void audio_init(const char *soundfont_path);
-void audio_cleanup(void);
-void audio_note_on(int channel, int preset, int note, float velocity);
-void audio_note_off(int channel, int note);
-void audio_render_samples(int16_t *buffer, size_t frames);
-int audio_write_wav(const char *text, uint32_t seed_hash, AudioData *data);
+// An engine owns one parsed soundfont. Encoders render through their own
+// voices and channels on top of an engine's font; several encoders may run
+// concurrently on separate threads. Encoders must be destroyed before their
+// engine.
+typedef struct sh_engine sh_engine;
+typedef struct sh_encoder sh_encoder;
+
+// Frames the synth renders between envelope, LFO and filter updates
+// (SYNTH_EFFECT_BLOCK); each render call starts a new block.
+#define AUDIO_EFFECT_BLOCK_FRAMES 64
+
+// MIDI channels of an encoder
+#define AUDIO_CHANNELS 16
+
+// Render loops a voice can get at note-on (SYNTH_VOICE_KERNELS)
+#define AUDIO_VOICE_KERNELS 8
+
+// Counters accumulated over an encoder's lifetime (not cleared by reset)
+typedef struct
+{
+    uint64_t render_calls;
+    uint64_t frames_rendered;
+    // Frames rendered summed over voices, at each voice's own rate (see
+    // channel_rate): voice_frames / frames_rendered is the average
+    // polyphony
+    uint64_t voice_frames;
+    uint32_t peak_voices;
+    uint64_t voices_stolen; // replaced at the polyphony cap
+    uint64_t voices_culled; // retired early as inaudible
+    // Voices started with each render loop, named by audio_voice_kernel_name
+    uint64_t voice_kernels[AUDIO_VOICE_KERNELS];
+} AudioStats;
+
+typedef struct
+{
+    // SF2 file or font image to map; NULL uses the soundfont embedded at
+    // build time
+    const char *soundfont_path;
+    // Share an external SF2's parsed tables between processes through POSIX
+    // shared memory: the first process publishes them, later ones map them
+    // read-only. Falls back to a private parse when that is not possible.
+    int shared_cache;
+    // Polyphony cap of each encoder, whose voices are allocated up front;
+    // 0 selects the default of 256
+    int max_voices;
+    // Voices stop rendering once the most they can add to an output sample
+    // is below this many 16-bit LSBs. AUDIO_CULL_OFF (0, as in a
+    // zero-initialised struct) renders every voice to its end; stringheat
+    // uses AUDIO_DEFAULT_CULL_LSB. Negative values are rejected.
+    float cull_threshold;
+    // AUDIO_ENGINE_VOICES renders voice by voice; AUDIO_ENGINE_BANK keeps the
+    // pool's audio-rate state in arrays and renders it in lane groups, which
+    // pays off at high polyphony. Output differs by at most a few LSBs.
+    int engine;
+    // Divides the rate each channel's voices render at: 2 or 4 halves or
+    // quarters their work, and an upsampler brings them back to 44.1 kHz
+    // without what lies above the reduced rate's Nyquist frequency, about
+    // 0.4 or 0.7 ms late (synth_set_channel_rate). 0 or 1 renders at the
+    // full rate. Suits the bass and pad channels (2 and 3); shbench rates
+    // reports the spectral error for each channel and divisor. Ignored by
+    // AUDIO_ENGINE_BANK.
+    int channel_rate[AUDIO_CHANNELS];
+} AudioOptions;
+
+#define AUDIO_CULL_OFF 0.0f
+#define AUDIO_DEFAULT_CULL_LSB 1.0f
+
+enum
+{
+    AUDIO_ENGINE_VOICES,
+    AUDIO_ENGINE_BANK
+};
+
+// Returns NULL on failure or invalid options. audio_init(path) uses
+// default options, which cull no voices.
+sh_engine *audio_init(const char *soundfont_path);
+sh_engine *audio_init_with(const AudioOptions *options);
+void audio_cleanup(sh_engine *engine);
+sh_encoder *audio_encoder_create(sh_engine *engine);
+int audio_encoder_reset(sh_encoder *enc);
+void audio_encoder_destroy(sh_encoder *enc);
+void audio_encoder_stats(const sh_encoder *enc, AudioStats *stats);
+// The same counters since the encoder was last reset (the current job)
+void audio_encoder_job_stats(const sh_encoder *enc, AudioStats *stats);
+void audio_stats_add(AudioStats *total, const AudioStats *stats);
+const char *audio_voice_kernel_name(int kernel);
+void audio_note_on(sh_encoder *enc, int channel, int preset, int note, float velocity);
+void audio_note_off(sh_encoder *enc, int channel, int note);
+// Starts reading in the samples preset plays for note on channel, so the
+// first note-on does not wait for them
+void audio_prefetch(sh_encoder *enc, int channel, int preset, int note);
+void audio_render_samples(sh_encoder *enc, int16_t *buffer, size_t frames);
+
+// WAV layouts: legacy files carry the metadata chunk after the PCM data,
+// layout 2 puts it between "fmt " and "data". Both decode.
+#define AUDIO_WAV_LEGACY 1
+#define AUDIO_WAV_V2 2
+
+// Longest text (in bytes) a WAV's metadata chunk carries: the writers below
+// fail on longer texts and decoders treat longer lengths as corrupt
+#define AUDIO_MAX_TEXT 10000
+
+int audio_write_wav(FILE *out, const char *text, uint32_t seed_hash, AudioData *data);
+// Pieces of audio_write_wav() for writers that produce the PCM themselves:
+// header, then exactly frame_count * 4 bytes of PCM, then trailer. The
+// header fails before writing anything if text is too long or the file
+// would pass the 4 GiB RIFF limit.
+int audio_write_wav_header(FILE *out, size_t frame_count, const char *text, uint32_t seed_hash, int layout);
+int audio_write_wav_trailer(FILE *out, const char *text, uint32_t seed_hash, int layout);
 char *audio_read_metadata(const char *filename, uint32_t seed_hash);
 
+enum
+{
+    AUDIO_DECODE_OK,
+    AUDIO_DECODE_IO_ERROR,
+    AUDIO_DECODE_NOT_WAV,
+    AUDIO_DECODE_NO_METADATA,
+    AUDIO_DECODE_WRONG_SEED,
+    AUDIO_DECODE_CORRUPT
+};
+
+// audio_read_metadata() with the failure reason; text is set only on
+// AUDIO_DECODE_OK. bytes_read (optional) receives the bytes actually read.
+int audio_decode_file(const char *filename, uint32_t seed_hash, char **text, uint64_t *bytes_read);
+const char *audio_decode_status_name(int status);
+
 #endif
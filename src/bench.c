@@ -0,0 +1,717 @@
+#include "audio.h"
+#include "encode.h"
+#include "presets.h"
+#include "synth.h"
+#include "timeline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Synth benchmarks. Each mode runs the same work under two setups and,
+// where it renders audio, checks that they agree before comparing cost.
+
+static const char *bench_texts[] = {
+    "the quick brown fox jumps over the lazy dog",
+    "all work and no play makes a dull song",
+    "meet me at the old bridge when the bells ring twice",
+    "somewhere over the rainbow way up high",
+};
+#define BENCH_TEXT_COUNT 4
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Last-level cache misses of this thread, or -1 where the kernel or the
+// machine offers no hardware counters
+static int llc_counter_open(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long llc_counter_read(int fd)
+{
+    long long count;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+typedef struct
+{
+    double seconds;
+    long long llc_misses;
+    double audio_seconds;
+    uint64_t checksum;
+} BenchResult;
+
+// Renders every bench text under tracks seeds through one engine
+static int render_tracks(sh_engine *engine, int tracks, BenchResult *result)
+{
+    sh_encoder *enc = audio_encoder_create(engine);
+    if (!enc)
+        return 0;
+
+    int counter = llc_counter_open();
+    long long misses_before = llc_counter_read(counter);
+    double start = now_seconds();
+    size_t frames = 0;
+    uint64_t checksum = 1469598103934665603ULL;
+
+    for (int t = 0; t < tracks; t++)
+    {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "bench%d", t);
+        AudioData *audio = encode_text(enc, bench_texts[t % BENCH_TEXT_COUNT], seed);
+        audio_encoder_reset(enc);
+        if (!audio)
+            continue;
+        frames += audio->frame_count;
+        for (size_t i = 0; i < audio->frame_count * 2; i++)
+            checksum = (checksum ^ (uint16_t)audio->buffer[i]) * 1099511628211ULL;
+        free(audio->buffer);
+        free(audio);
+    }
+
+    result->seconds = now_seconds() - start;
+    long long misses_after = llc_counter_read(counter);
+    result->llc_misses = misses_before >= 0 && misses_after >= 0 ? misses_after - misses_before : -1;
+    result->audio_seconds = frames / 44100.0;
+    result->checksum = checksum;
+    if (counter >= 0)
+        close(counter);
+    audio_encoder_destroy(enc);
+    return 1;
+}
+
+static void print_result(const char *label, const BenchResult *r)
+{
+    printf("%-12s %8.3f s  %7.1fx realtime  ", label, r->seconds, r->audio_seconds / r->seconds);
+    if (r->llc_misses >= 0)
+        printf("%12lld LLC misses\n", r->llc_misses);
+    else
+        printf("  LLC misses n/a\n");
+}
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = len > 0 ? malloc(len) : NULL;
+    if (!data || fread(data, 1, len, f) != (size_t)len)
+    {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *size = (size_t)len;
+    return data;
+}
+
+// File-order sample pool (the SF2 as mapped) against the same font repacked
+// per preset on cache lines
+static int bench_layout(const char *font_path, int tracks)
+{
+    size_t size;
+    unsigned char *data = read_file(font_path, &size);
+    SynthFont *font = data ? synth_font_load_sf2(data, size) : NULL;
+    if (!font)
+    {
+        fprintf(stderr, "Error: Cannot load '%s'\n", font_path);
+        free(data);
+        return 1;
+    }
+
+    SynthPresetFilter *all = malloc(font->preset_count * sizeof(SynthPresetFilter));
+    for (uint32_t i = 0; all && i < font->preset_count; i++)
+        all[i] = (SynthPresetFilter){font->presets[i].bank, font->presets[i].preset, NULL, 0};
+    SynthFont *packed = all ? synth_font_prune(font, all, (int)font->preset_count) : NULL;
+    free(all);
+
+    char image_path[] = "/tmp/shbench-XXXXXX";
+    int fd = mkstemp(image_path);
+    FILE *image = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    int written = packed && image && synth_font_write_image(packed, image, SYNTH_IMAGE_RAW);
+    if (image)
+        fclose(image);
+    printf("Font: %s, %u presets, %u regions, %.1f MB of samples\n", font_path, font->preset_count,
+           font->region_count, font->sample_count * 2 / 1e6);
+    synth_font_free(packed);
+    synth_font_free(font);
+    free(data);
+    if (!written)
+    {
+        fprintf(stderr, "Error: Cannot write the repacked image\n");
+        if (fd >= 0)
+            unlink(image_path);
+        return 1;
+    }
+
+    BenchResult file_order, repacked;
+    sh_engine *file_engine = audio_init(font_path);
+    sh_engine *packed_engine = audio_init(image_path);
+    int ok = file_engine && packed_engine && render_tracks(file_engine, tracks, &file_order) &&
+             render_tracks(packed_engine, tracks, &repacked);
+    audio_cleanup(file_engine);
+    audio_cleanup(packed_engine);
+    unlink(image_path);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Rendering failed\n");
+        return 1;
+    }
+
+    printf("%d tracks, %.1f s audio each run\n", tracks, file_order.audio_seconds);
+    print_result("file order", &file_order);
+    print_result("repacked", &repacked);
+    if (file_order.checksum != repacked.checksum)
+    {
+        fprintf(stderr, "Error: Layouts rendered different audio\n");
+        return 1;
+    }
+    printf("Output identical\n");
+    return 0;
+}
+
+// Plays the composer's instruments the way encode.c does: notes on the
+// melodic channels and the drum kit, each preceded by its preset
+static double time_note_ons(sh_engine *engine, int notes)
+{
+    sh_encoder *enc = audio_encoder_create(engine);
+    if (!enc)
+        return -1;
+
+    double start = 0;
+    // The first round only decodes or pages in samples and is not timed
+    for (int round = 0; round < 2; round++)
+    {
+        if (round == 1)
+            start = now_seconds();
+        for (int n = 0; n < notes; n++)
+        {
+            int channel = n % 5, preset, key;
+            switch (channel)
+            {
+            case 0:
+                preset = melody_presets[n / 5 % MELODY_PRESET_COUNT], key = 60 + n % 24;
+                break;
+            case 1:
+                preset = harmony_presets[n / 5 % HARMONY_PRESET_COUNT], key = 48 + n % 24;
+                break;
+            case 2:
+                preset = BASS_PRESET_FIRST + n / 5 % BASS_PRESET_COUNT, key = 28 + n % 12;
+                break;
+            case 3:
+                preset = PAD_PRESET_FIRST + n / 5 % PAD_PRESET_COUNT, key = 48 + n % 24;
+                break;
+            default:
+                channel = 9, preset = DRUM_KIT_PRESET, key = drum_notes[n / 5 % DRUM_NOTE_COUNT];
+                break;
+            }
+            audio_note_on(enc, channel, preset, key, 0.8f);
+            // Voices are never rendered here, so drop them before they pile up
+            if (n % 64 == 63)
+                audio_encoder_reset(enc);
+        }
+        audio_encoder_reset(enc);
+    }
+    double seconds = now_seconds() - start;
+    audio_encoder_destroy(enc);
+    return seconds;
+}
+
+// Note-on cost with the pruned embedded font against a full external font;
+// with lookup tables the two should be close
+static int bench_noteon(const char *font_path, int notes)
+{
+    sh_engine *embedded = audio_init(NULL);
+    sh_engine *external = audio_init(font_path);
+    double small = embedded ? time_note_ons(embedded, notes) : -1;
+    double large = external ? time_note_ons(external, notes) : -1;
+    audio_cleanup(embedded);
+    audio_cleanup(external);
+    if (small < 0 || large < 0)
+    {
+        fprintf(stderr, "Error: Cannot load '%s'\n", large < 0 ? font_path : "embedded font");
+        return 1;
+    }
+
+    printf("%d note-ons each\n", notes);
+    printf("%-12s %8.1f ns per note-on\n", "embedded", small * 1e9 / notes);
+    printf("%-12s %8.1f ns per note-on\n", "external", large * 1e9 / notes);
+    return 0;
+}
+
+typedef struct
+{
+    double seconds[2];
+    size_t samples, differing;
+    int max_diff;
+    AudioStats stats[2];
+} PairResult;
+
+// Renders every bench track through both encoders and compares the output
+// sample by sample
+static int render_pair(sh_encoder *encoders[2], int tracks, PairResult *result)
+{
+    memset(result, 0, sizeof(*result));
+    for (int t = 0; t < tracks; t++)
+    {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "bench%d", t);
+        const char *text = bench_texts[t % BENCH_TEXT_COUNT];
+        AudioData *audio[2];
+        for (int e = 0; e < 2; e++)
+        {
+            double start = now_seconds();
+            audio[e] = encode_text(encoders[e], text, seed);
+            result->seconds[e] += now_seconds() - start;
+            audio_encoder_reset(encoders[e]);
+        }
+
+        int ok = audio[0] && audio[1] && audio[0]->frame_count == audio[1]->frame_count;
+        for (size_t i = 0; ok && i < audio[0]->frame_count * 2; i++)
+        {
+            int diff = abs(audio[0]->buffer[i] - audio[1]->buffer[i]);
+            result->differing += diff != 0;
+            if (diff > result->max_diff)
+                result->max_diff = diff;
+        }
+        if (ok)
+            result->samples += audio[0]->frame_count * 2;
+        for (int e = 0; e < 2; e++)
+        {
+            if (audio[e])
+                free(audio[e]->buffer);
+            free(audio[e]);
+        }
+        if (!ok)
+            return 0;
+    }
+    for (int e = 0; e < 2; e++)
+        audio_encoder_stats(encoders[e], &result->stats[e]);
+    return 1;
+}
+
+// Creates an encoder per engine; on failure everything is released
+static int create_pair(sh_engine *engines[2], sh_encoder *encoders[2])
+{
+    for (int e = 0; e < 2; e++)
+        encoders[e] = audio_encoder_create(engines[e]);
+    if (encoders[0] && encoders[1])
+        return 1;
+    for (int e = 0; e < 2; e++)
+    {
+        audio_encoder_destroy(encoders[e]);
+        audio_cleanup(engines[e]);
+    }
+    fprintf(stderr, "Error: Cannot load the embedded font\n");
+    return 0;
+}
+
+static void destroy_pair(sh_engine *engines[2], sh_encoder *encoders[2])
+{
+    for (int e = 0; e < 2; e++)
+    {
+        audio_encoder_destroy(encoders[e]);
+        audio_cleanup(engines[e]);
+    }
+}
+
+static void print_difference(const PairResult *r)
+{
+    printf("Max sample difference %d LSB, %zu of %zu samples differ\n", r->max_diff, r->differing, r->samples);
+}
+
+// Every voice rendered to its end against voices culled below threshold
+// LSBs, on the embedded font
+static int bench_cull(int tracks, float threshold)
+{
+    AudioOptions options[2] = {{NULL, 0, 0, AUDIO_CULL_OFF, AUDIO_ENGINE_VOICES},
+                               {NULL, 0, 0, threshold, AUDIO_ENGINE_VOICES}};
+    sh_engine *engines[2] = {audio_init_with(&options[0]), audio_init_with(&options[1])};
+    sh_encoder *encoders[2];
+    if (!create_pair(engines, encoders))
+        return 1;
+    PairResult r;
+    int ok = render_pair(encoders, tracks, &r);
+    destroy_pair(engines, encoders);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Rendering failed\n");
+        return 1;
+    }
+
+    uint64_t full = r.stats[0].voice_frames, culled = r.stats[1].voice_frames;
+    printf("%d tracks, %.1f s audio, threshold %.2f LSB\n", tracks, r.samples / 2 / 44100.0, threshold);
+    printf("%-12s %8.3f s  %12llu voice-samples\n", "full", r.seconds[0], (unsigned long long)full);
+    printf("%-12s %8.3f s  %12llu voice-samples  (%llu culled voices)\n", "culled", r.seconds[1],
+           (unsigned long long)culled, (unsigned long long)r.stats[1].voices_culled);
+    printf("Saved %llu voice-samples (%.1f%%)\n", (unsigned long long)(full - culled),
+           full ? 100.0 * (full - culled) / full : 0.0);
+    print_difference(&r);
+    return 0;
+}
+
+// Scalar inner loops against each SIMD level the CPU supports
+static int bench_simd(int tracks)
+{
+    printf("%d tracks\n", tracks);
+    for (int level = SYNTH_KERNELS_SSE2; level <= SYNTH_KERNELS_BEST; level++)
+    {
+        if (synth_use_kernels(level) != level)
+        {
+            printf("%-12s not supported by this CPU\n", synth_kernels_name(level));
+            continue;
+        }
+        sh_engine *engines[2] = {audio_init(NULL), audio_init(NULL)};
+        sh_encoder *encoders[2] = {NULL, NULL};
+        // Kernels are fixed when an encoder's synth is created
+        synth_use_kernels(SYNTH_KERNELS_SCALAR);
+        encoders[0] = engines[0] ? audio_encoder_create(engines[0]) : NULL;
+        synth_use_kernels(level);
+        encoders[1] = engines[1] ? audio_encoder_create(engines[1]) : NULL;
+        if (!encoders[0] || !encoders[1])
+        {
+            destroy_pair(engines, encoders);
+            fprintf(stderr, "Error: Cannot load the embedded font\n");
+            return 1;
+        }
+        PairResult r;
+        int ok = render_pair(encoders, tracks, &r);
+        destroy_pair(engines, encoders);
+        if (!ok)
+        {
+            fprintf(stderr, "Error: Rendering failed\n");
+            return 1;
+        }
+        printf("%-12s %8.3f s  %-8s %8.3f s  (%.2fx)  ", "scalar", r.seconds[0], synth_kernels_name(level),
+               r.seconds[1], r.seconds[0] / r.seconds[1]);
+        print_difference(&r);
+        if (r.max_diff > 1)
+        {
+            fprintf(stderr, "Error: %s exceeds the 1 LSB tolerance\n", synth_kernels_name(level));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Holds notes on the pad and harmony presets through both encoders,
+// renders seconds of audio in blocks and compares the output
+static int render_chord(sh_encoder *encoders[2], int notes, double seconds, PairResult *result)
+{
+    enum { BLOCK = 4096 };
+    static int16_t buffers[2][BLOCK * 2];
+    memset(result, 0, sizeof(*result));
+    for (int e = 0; e < 2; e++)
+    {
+        audio_encoder_reset(encoders[e]);
+        for (int n = 0; n < notes; n++)
+        {
+            int channel = n % 4;
+            int preset = channel < 2 ? PAD_PRESET_FIRST + (n / 4 + channel) % PAD_PRESET_COUNT
+                                     : harmony_presets[(n / 4 + channel) % HARMONY_PRESET_COUNT];
+            audio_note_on(encoders[e], channel, preset, 36 + n * 7 % 60, 0.5f);
+        }
+    }
+
+    size_t frames = (size_t)(seconds * 44100.0);
+    for (size_t done = 0; done < frames; done += BLOCK)
+    {
+        size_t n = frames - done < BLOCK ? frames - done : BLOCK;
+        for (int e = 0; e < 2; e++)
+        {
+            double start = now_seconds();
+            audio_render_samples(encoders[e], buffers[e], n);
+            result->seconds[e] += now_seconds() - start;
+        }
+        for (size_t i = 0; i < n * 2; i++)
+        {
+            int diff = abs(buffers[0][i] - buffers[1][i]);
+            result->differing += diff != 0;
+            if (diff > result->max_diff)
+                result->max_diff = diff;
+        }
+        result->samples += n * 2;
+    }
+    for (int e = 0; e < 2; e++)
+        audio_encoder_job_stats(encoders[e], &result->stats[e]);
+    return 1;
+}
+
+// Stock voice-by-voice loop against the voice bank, first at fixed
+// polyphony from held chords with culling off, then on the bench tracks
+static int bench_bank(int tracks)
+{
+    static const int levels[] = {2, 4, 8, 16, 32, 64, 128};
+    AudioOptions options[2] = {{NULL, 0, 0, AUDIO_CULL_OFF, AUDIO_ENGINE_VOICES},
+                               {NULL, 0, 0, AUDIO_CULL_OFF, AUDIO_ENGINE_BANK}};
+    sh_engine *engines[2] = {audio_init_with(&options[0]), audio_init_with(&options[1])};
+    sh_encoder *encoders[2];
+    if (!create_pair(engines, encoders))
+        return 1;
+
+    printf("Kernels %s\n", synth_kernels_name(SYNTH_KERNELS_BEST));
+    printf("%-6s %7s %10s %10s %8s %10s\n", "notes", "voices", "per-voice", "bank", "speedup", "max diff");
+    int worst = 0;
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+    {
+        PairResult r;
+        render_chord(encoders, levels[i], 10.0, &r);
+        // Average voices actually sounding, as some samples end early
+        double sounding = (double)r.stats[0].voice_frames / (r.samples / 2);
+        printf("%-6d %7.1f %8.3f s %8.3f s %7.2fx %6d LSB\n", levels[i], sounding, r.seconds[0], r.seconds[1],
+               r.seconds[0] / r.seconds[1], r.max_diff);
+        if (r.max_diff > worst)
+            worst = r.max_diff;
+    }
+    destroy_pair(engines, encoders);
+
+    for (int e = 0; e < 2; e++)
+        options[e].cull_threshold = AUDIO_DEFAULT_CULL_LSB;
+    engines[0] = audio_init_with(&options[0]);
+    engines[1] = audio_init_with(&options[1]);
+    if (!create_pair(engines, encoders))
+        return 1;
+    PairResult r;
+    int ok = render_pair(encoders, tracks, &r);
+    destroy_pair(engines, encoders);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Rendering failed\n");
+        return 1;
+    }
+    printf("%d tracks, culled, peak %d voices: %8.3f s  bank %8.3f s  (%.2fx)\n", tracks, r.stats[0].peak_voices,
+           r.seconds[0], r.seconds[1], r.seconds[0] / r.seconds[1]);
+    print_difference(&r);
+    return 0;
+}
+
+// In-place radix-2 FFT of n (a power of two) complex values
+static void fft(double *re, double *im, int n)
+{
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j)
+        {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        double angle = -2.0 * M_PI / len;
+        for (int i = 0; i < n; i += len)
+            for (int k = 0; k < len / 2; k++)
+            {
+                double wr = cos(angle * k), wi = sin(angle * k);
+                double *ur = &re[i + k], *ui = &im[i + k], *vr = &re[i + k + len / 2], *vi = &im[i + k + len / 2];
+                double xr = *vr * wr - *vi * wi, xi = *vr * wi + *vi * wr;
+                *vr = *ur - xr;
+                *vi = *ui - xi;
+                *ur += xr;
+                *ui += xi;
+            }
+    }
+}
+
+#define SPECTRUM_SIZE 2048
+
+// Magnitude spectra of the mono mix of test against reference, Hann
+// windows every SPECTRUM_SIZE / 4 frames. Adds the squared magnitude
+// differences to error and the reference's squared magnitudes to energy,
+// so a small delay between the two does not count; index 0 sums bins below
+// band (a fraction of the Nyquist frequency), index 1 those above.
+static void spectral_error(const int16_t *reference, const int16_t *test, size_t frames, double band,
+                           double error[2], double *energy)
+{
+    static double re[2][SPECTRUM_SIZE], im[2][SPECTRUM_SIZE];
+    const int16_t *pcm[2] = {reference, test};
+    for (size_t start = 0; start + SPECTRUM_SIZE <= frames; start += SPECTRUM_SIZE / 4)
+    {
+        for (int s = 0; s < 2; s++)
+        {
+            for (int i = 0; i < SPECTRUM_SIZE; i++)
+            {
+                double window = 0.5 - 0.5 * cos(2.0 * M_PI * i / SPECTRUM_SIZE);
+                const int16_t *frame = pcm[s] + (start + i) * 2;
+                re[s][i] = window * (frame[0] + frame[1]) * 0.5;
+                im[s][i] = 0.0;
+            }
+            fft(re[s], im[s], SPECTRUM_SIZE);
+        }
+        for (int k = 0; k <= SPECTRUM_SIZE / 2; k++)
+        {
+            double a = hypot(re[0][k], im[0][k]), b = hypot(re[1][k], im[1][k]);
+            error[k >= band * SPECTRUM_SIZE / 2] += (a - b) * (a - b);
+            *energy += a * a;
+        }
+    }
+}
+
+// Every channel of the bench tracks on its own, at full rate against 1/2
+// and 1/4 rate (AudioOptions.channel_rate): voice frames, render time and
+// the spectral error of the reduced-rate output, to pick each channel's
+// rate from
+static int bench_rates(int tracks)
+{
+    static const int channels[] = {0, 1, 2, 3, 9};
+    static const char *const names[] = {"melody", "harmony", "bass", "pad", "drums"};
+    enum { CHANNEL_COUNT = 5, RATES = 3 };
+    sh_engine *engines[RATES];
+    sh_encoder *encoders[RATES];
+    int ok = 1;
+    for (int e = 0; e < RATES; e++)
+    {
+        AudioOptions options = {NULL, 0, 0, AUDIO_DEFAULT_CULL_LSB, AUDIO_ENGINE_VOICES};
+        // Only one channel plays at a time, so all of them can use the rate
+        for (int c = 0; c < AUDIO_CHANNELS; c++)
+            options.channel_rate[c] = 1 << e;
+        engines[e] = audio_init_with(&options);
+        encoders[e] = audio_encoder_create(engines[e]);
+        ok = ok && encoders[e];
+    }
+
+    Timeline tl, solo;
+    timeline_init(&tl);
+    timeline_init(&solo);
+    double seconds[CHANNEL_COUNT][RATES] = {{0}}, error[CHANNEL_COUNT][RATES][2] = {{{0}}};
+    double energy[CHANNEL_COUNT][RATES] = {{0}};
+    uint64_t voice_frames[CHANNEL_COUNT][RATES] = {{0}};
+    for (int t = 0; ok && t < tracks; t++)
+    {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "bench%d", t);
+        tl.event_count = 0;
+        ok = encode_compile(bench_texts[t % BENCH_TEXT_COUNT], seed, &tl);
+        int16_t *pcm[RATES] = {NULL, NULL, NULL};
+        for (int e = 0; ok && e < RATES; e++)
+            ok = (pcm[e] = malloc(tl.frame_count * 4)) != NULL;
+        for (int ch = 0; ok && ch < CHANNEL_COUNT; ch++)
+        {
+            solo.event_count = 0;
+            solo.frame_count = tl.frame_count;
+            for (size_t i = 0; i < tl.event_count; i++)
+            {
+                const NoteEvent *ev = &tl.events[i];
+                if (ev->channel != channels[ch])
+                    continue;
+                if (ev->type == EVENT_NOTE_ON)
+                    timeline_note_on(&solo, ev->frame, ev->channel, ev->preset, ev->note, ev->velocity);
+                else
+                    timeline_note_off(&solo, ev->frame, ev->channel, ev->note);
+            }
+            ok = !solo.oom;
+            for (int e = 0; ok && e < RATES; e++)
+            {
+                AudioStats stats;
+                double start = now_seconds();
+                timeline_render_into(encoders[e], &solo, pcm[e]);
+                seconds[ch][e] += now_seconds() - start;
+                audio_encoder_job_stats(encoders[e], &stats);
+                voice_frames[ch][e] += stats.voice_frames;
+                audio_encoder_reset(encoders[e]);
+                if (e > 0)
+                    spectral_error(pcm[0], pcm[e], tl.frame_count, 1.0 / (1 << e), error[ch][e], &energy[ch][e]);
+            }
+        }
+        for (int e = 0; e < RATES; e++)
+            free(pcm[e]);
+    }
+    timeline_free(&tl);
+    timeline_free(&solo);
+    for (int e = 0; e < RATES; e++)
+    {
+        audio_encoder_destroy(encoders[e]);
+        audio_cleanup(engines[e]);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Rendering failed\n");
+        return 1;
+    }
+
+    // Spectral error is the difference of the magnitude spectra relative to
+    // the full-rate spectrum's energy (-20 dB is 1%), in all, below the
+    // reduced rate's Nyquist frequency (distortion) and above it (lost)
+    printf("%d tracks, each channel alone\n", tracks);
+    printf("%-8s %4s %12s %10s %8s %29s\n", "channel", "rate", "voice frames", "time", "speedup",
+           "spectral error: all  below  above");
+    for (int ch = 0; ch < CHANNEL_COUNT; ch++)
+        for (int e = 0; e < RATES; e++)
+        {
+            char rate[8];
+            snprintf(rate, sizeof(rate), "1/%d", 1 << e);
+            printf("%-8s %4s %12llu %8.3f s %7.2fx", e ? "" : names[ch], rate,
+                   (unsigned long long)voice_frames[ch][e], seconds[ch][e],
+                   seconds[ch][e] > 0 ? seconds[ch][0] / seconds[ch][e] : 0.0);
+            if (e && energy[ch][e] > 0)
+            {
+                double all = error[ch][e][0] + error[ch][e][1];
+                printf(" %21.1f %6.1f %6.1f dB", 10.0 * log10(all / energy[ch][e]),
+                       10.0 * log10(error[ch][e][0] / energy[ch][e]), 10.0 * log10(error[ch][e][1] / energy[ch][e]));
+            }
+            printf("\n");
+        }
+    return 0;
+}
+
+static void print_usage(void)
+{
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  shbench layout <font.sf2> [tracks]   Sample pool in file order vs repacked\n");
+    fprintf(stderr, "  shbench noteon <font.sf2> [notes]    Note-on cost, embedded vs external font\n");
+    fprintf(stderr, "  shbench cull [tracks] [lsb]          Every voice rendered vs inaudible ones culled\n");
+    fprintf(stderr, "  shbench simd [tracks]                Scalar inner loops vs each SIMD level\n");
+    fprintf(stderr, "  shbench bank [tracks]                Per-voice loop vs the voice bank by polyphony\n");
+    fprintf(stderr, "  shbench rates [tracks]               Each channel at full, 1/2 and 1/4 rate: work and\n");
+    fprintf(stderr, "                                       spectral error\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && strcmp(argv[1], "layout") == 0)
+        return bench_layout(argv[2], argc > 3 ? atoi(argv[3]) : 16);
+    if (argc >= 3 && strcmp(argv[1], "noteon") == 0)
+        return bench_noteon(argv[2], argc > 3 ? atoi(argv[3]) : 1000000);
+    if (argc >= 2 && strcmp(argv[1], "cull") == 0)
+        return bench_cull(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? (float)atof(argv[3]) : AUDIO_DEFAULT_CULL_LSB);
+    if (argc >= 2 && strcmp(argv[1], "simd") == 0)
+        return bench_simd(argc > 2 ? atoi(argv[2]) : 16);
+    if (argc >= 2 && strcmp(argv[1], "bank") == 0)
+        return bench_bank(argc > 2 ? atoi(argv[2]) : 16);
+    if (argc >= 2 && strcmp(argv[1], "rates") == 0)
+        return bench_rates(argc > 2 ? atoi(argv[2]) : 4);
+
+    print_usage();
+    return 1;
+}
@@ -0,0 +1,154 @@
+#include "audio.h"
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Regression checks (make check) over the public API and the embedded font.
+// Each check prints one line and the exit status counts the failures.
+
+static int failures;
+
+static void report(int ok, const char *name, const char *detail)
+{
+    printf("%s %s%s%s\n", ok ? "ok  " : "FAIL", name, detail[0] ? ": " : "", detail);
+    if (!ok)
+        failures++;
+}
+
+// A composed track of about 2600 characters, longer than most texts
+static char *long_text(void)
+{
+    static const char phrase[] = "meet me at the old bridge when the bells ring twice and bring the map ";
+    size_t count = 38, size = count * (sizeof(phrase) - 1) + 1;
+    char *text = malloc(size);
+    if (!text)
+        return NULL;
+    text[0] = '\0';
+    for (size_t i = 0; i < count; i++)
+        strcat(text, phrase);
+    return text;
+}
+
+// Encodes a long track at the default polyphony cap; the composer's notes
+// must never need more voices than that, so none may be stolen
+static void check_no_stealing(const char *name, int engine, float cull)
+{
+    char detail[128] = "";
+    AudioOptions options = {NULL, 0, 0, cull, engine};
+    sh_engine *synth = audio_init_with(&options);
+    sh_encoder *enc = synth ? audio_encoder_create(synth) : NULL;
+    char *text = long_text();
+    FILE *out = fopen("/dev/null", "wb");
+    size_t frames;
+    int ok = enc && text && out && encode_text_stream(enc, out, text, "check", &frames);
+    if (ok)
+    {
+        AudioStats stats;
+        audio_encoder_stats(enc, &stats);
+        snprintf(detail, sizeof(detail), "peak %u voices, %llu stolen", stats.peak_voices,
+                 (unsigned long long)stats.voices_stolen);
+        ok = stats.voices_stolen == 0;
+    }
+    report(ok, name, detail);
+    if (out)
+        fclose(out);
+    free(text);
+    if (enc)
+        audio_encoder_destroy(enc);
+    if (synth)
+        audio_cleanup(synth);
+}
+
+// Writes a short WAV carrying text in layout and decodes it again. Returns
+// 1 if the text came back, 0 if the header was refused and -1 otherwise.
+static int metadata_round_trip(const char *text, int layout)
+{
+    char path[] = "/tmp/stringheat-check-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    FILE *out = fdopen(fd, "wb");
+    if (!out)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    int16_t pcm[2 * 16] = {0};
+    uint32_t seed_hash = hash_seed("check");
+    int written = audio_write_wav_header(out, 16, text, seed_hash, layout);
+    if (written)
+        written = fwrite(pcm, 4, 16, out) == 16 && audio_write_wav_trailer(out, text, seed_hash, layout);
+    fclose(out);
+
+    int result = 0;
+    char *decoded = NULL;
+    if (written)
+        result = audio_decode_file(path, seed_hash, &decoded, NULL) == AUDIO_DECODE_OK && strcmp(decoded, text) == 0
+                     ? 1
+                     : -1;
+    free(decoded);
+    unlink(path);
+    return result;
+}
+
+// Texts of exactly AUDIO_MAX_TEXT bytes round-trip in both layouts; one
+// byte more is refused by the writer
+static void check_metadata_limit(void)
+{
+    char *text = malloc(AUDIO_MAX_TEXT + 2);
+    if (!text)
+    {
+        report(0, "metadata length limit", "out of memory");
+        return;
+    }
+    for (int i = 0; i <= AUDIO_MAX_TEXT; i++)
+        text[i] = i % 7 == 6 ? ' ' : 'a' + i % 26;
+    text[AUDIO_MAX_TEXT + 1] = '\0';
+
+    int layouts[] = {AUDIO_WAV_LEGACY, AUDIO_WAV_V2};
+    for (int l = 0; l < 2; l++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "metadata length limit, layout %d", layouts[l]);
+        int too_long = metadata_round_trip(text, layouts[l]);
+        text[AUDIO_MAX_TEXT] = '\0';
+        int longest = metadata_round_trip(text, layouts[l]);
+        text[AUDIO_MAX_TEXT] = 'x';
+        report(longest == 1 && too_long == 0, name,
+               longest != 1 ? "longest text did not round-trip" : too_long != 0 ? "over-long text was written" : "");
+    }
+    free(text);
+}
+
+// Headers whose 32-bit RIFF sizes would wrap are refused without writing
+static void check_wav_size_limit(void)
+{
+    FILE *out = tmpfile();
+    if (!out)
+    {
+        report(0, "4 GiB WAV limit", "no temporary file");
+        return;
+    }
+    uint32_t seed_hash = hash_seed("check");
+    int largest = audio_write_wav_header(out, 1000000000, "hello", seed_hash, AUDIO_WAV_V2);
+    long written = ftell(out);
+    rewind(out);
+    int too_large = audio_write_wav_header(out, (size_t)1 << 30, "hello", seed_hash, AUDIO_WAV_V2);
+    int too_large_written = ftell(out) != 0;
+    fclose(out);
+    report(largest && written > 0 && !too_large && !too_large_written, "4 GiB WAV limit",
+           !largest ? "header under 4 GiB refused" : too_large || too_large_written ? "wrapped header written" : "");
+}
+
+int main(void)
+{
+    check_metadata_limit();
+    check_wav_size_limit();
+    check_no_stealing("no stealing at the default cap", AUDIO_ENGINE_VOICES, AUDIO_DEFAULT_CULL_LSB);
+    check_no_stealing("no stealing at the default cap, bank engine", AUDIO_ENGINE_BANK, AUDIO_DEFAULT_CULL_LSB);
+    check_no_stealing("no stealing at the default cap, culling off", AUDIO_ENGINE_VOICES, AUDIO_CULL_OFF);
+    return failures ? 1 : 0;
+}
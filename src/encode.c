@@ -1,5 +1,6 @@
 #include "encode.h"
 #include "audio.h"
+#include "presets.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -78,7 +79,15 @@ static const int drum_patterns[][16] = {
     {1, 1, 0, 0, 1, 0, 1, 1, 0, 0, 1, 0, 1, 0, 0, 1},
     {1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 1, 0, 1, 0}};
 
-AudioData *encode_text(const char *text, const char *seed)
+// Moves the song position forward, never past the end of the track
+static void advance(size_t *current_frame, size_t frames, size_t total_frames)
+{
+    if (*current_frame + frames > total_frames)
+        frames = total_frames - *current_frame;
+    *current_frame += frames;
+}
+
+int encode_compile(const char *text, const char *seed, Timeline *tl)
 {
     uint32_t seed_hash = hash_seed(seed);
     uint32_t char_hash = seed_hash;
@@ -98,35 +107,19 @@ AudioData *encode_text(const char *text, const char *seed)
     int base_tempo_ms = 280 + (rng_next(&rng) % 120); // Slower, more relaxed
     int drum_pattern = rng_next(&rng) % 5;
 
-    int melody_instrument = (rng_next(&rng) % 4);
-    int melody_presets[] = {0, 24, 73, 11};
+    int melody_instrument = (rng_next(&rng) % MELODY_PRESET_COUNT);
     int melody_preset = melody_presets[melody_instrument];
 
-    int harmony_instrument = (rng_next(&rng) % 3);
-    int harmony_presets[] = {0, 4, 48}; // Piano, EP, Strings
+    int harmony_instrument = (rng_next(&rng) % HARMONY_PRESET_COUNT);
     int harmony_preset = harmony_presets[harmony_instrument];
 
-    int bass_preset = 32 + (rng_next(&rng) % 4);
-    int pad_preset = 88 + (rng_next(&rng) % 8);
+    int bass_preset = BASS_PRESET_FIRST + (rng_next(&rng) % BASS_PRESET_COUNT);
+    int pad_preset = PAD_PRESET_FIRST + (rng_next(&rng) % PAD_PRESET_COUNT);
 
     size_t text_len = strlen(text);
     size_t avg_char_duration_frames = (base_tempo_ms * 44100) / 1000;
     size_t total_frames = (text_len * avg_char_duration_frames) + (44100 * 2);
 
-    AudioData *audio = malloc(sizeof(AudioData));
-    if (!audio)
-        return NULL;
-
-    audio->buffer = calloc(total_frames * 2, sizeof(int16_t));
-    audio->frame_count = total_frames;
-    audio->sample_rate = 44100;
-
-    if (!audio->buffer)
-    {
-        free(audio);
-        return NULL;
-    }
-
     size_t current_frame = 0;
     int beat_count = 0;
     int phrase_count = 0;
@@ -151,14 +144,7 @@ AudioData *encode_text(const char *text, const char *seed)
 
         if (c == ' ')
         {
-            size_t rest_frames = duration_frames / 3;
-            if (current_frame + rest_frames > total_frames)
-                rest_frames = total_frames - current_frame;
-            if (rest_frames > 0)
-            {
-                audio_render_samples(audio->buffer + current_frame * 2, rest_frames);
-                current_frame += rest_frames;
-            }
+            advance(&current_frame, duration_frames / 3, total_frames);
             beat_count++;
             phrase_count++;
             continue;
@@ -196,22 +182,22 @@ AudioData *encode_text(const char *text, const char *seed)
         // Release with slight overlap for smoothness
         if (prev_melody_note != -1 && prev_melody_note != melody_note)
         {
-            audio_note_off(0, prev_melody_note);
+            timeline_note_off(tl, current_frame, 0, prev_melody_note);
         }
         if (prev_harmony_note != -1 && i % 2 == 0)
         {
-            audio_note_off(1, prev_harmony_note);
+            timeline_note_off(tl, current_frame, 1, prev_harmony_note);
         }
 
         // Melody - softer, more musical
-        audio_note_on(0, melody_preset, melody_note, velocity * 0.6f);
+        timeline_note_on(tl, current_frame, 0, melody_preset, melody_note, velocity * 0.6f);
         prev_melody_note = melody_note;
 
         // Harmony - play on downbeats and longer notes
         if (i % 2 == 0 || duration_variation == 2)
         {
             int harmony_note = base_note;
-            audio_note_on(1, harmony_preset, harmony_note, velocity * 0.35f);
+            timeline_note_on(tl, current_frame, 1, harmony_preset, harmony_note, velocity * 0.35f);
             prev_harmony_note = harmony_note;
         }
 
@@ -223,8 +209,8 @@ AudioData *encode_text(const char *text, const char *seed)
                 bass_note = prev_bass_note + ((bass_note > prev_bass_note) ? 5 : -5);
             }
             if (prev_bass_note != -1)
-                audio_note_off(2, prev_bass_note);
-            audio_note_on(2, bass_preset, bass_note, velocity * 0.5f);
+                timeline_note_off(tl, current_frame, 2, prev_bass_note);
+            timeline_note_on(tl, current_frame, 2, bass_preset, bass_note, velocity * 0.5f);
             prev_bass_note = bass_note;
         } // Pads - sustained chords every 4 beats, released after 3 beats
         if (i % 4 == 0)
@@ -232,14 +218,14 @@ AudioData *encode_text(const char *text, const char *seed)
             for (int j = 0; j < 4; j++)
             {
                 if (prev_pad_notes[j] != -1)
-                    audio_note_off(3, prev_pad_notes[j]);
+                    timeline_note_off(tl, current_frame, 3, prev_pad_notes[j]);
                 prev_pad_notes[j] = -1;
             }
 
             for (int j = 0; j < 3 && chord_intervals[chord_type][j] != -1; j++)
             {
                 int chord_note = base_note + chord_intervals[chord_type][j];
-                audio_note_on(3, pad_preset, chord_note, velocity * 0.25f);
+                timeline_note_on(tl, current_frame, 3, pad_preset, chord_note, velocity * 0.25f);
                 prev_pad_notes[j] = chord_note;
             }
         }
@@ -250,7 +236,7 @@ AudioData *encode_text(const char *text, const char *seed)
             for (int j = 0; j < 4; j++)
             {
                 if (prev_pad_notes[j] != -1)
-                    audio_note_off(3, prev_pad_notes[j]);
+                    timeline_note_off(tl, current_frame, 3, prev_pad_notes[j]);
                 prev_pad_notes[j] = -1;
             }
         }
@@ -258,30 +244,21 @@ AudioData *encode_text(const char *text, const char *seed)
         // Gentler drums
         if (drum_patterns[drum_pattern][beat_count % 16])
         {
-            audio_note_on(9, 0, 36, 0.4f);  // Softer kick
-            audio_note_on(9, 0, 42, 0.25f); // Softer hi-hat
+            timeline_note_on(tl, current_frame, 9, DRUM_KIT_PRESET, DRUM_KICK, 0.4f);   // Softer kick
+            timeline_note_on(tl, current_frame, 9, DRUM_KIT_PRESET, DRUM_HIHAT, 0.25f); // Softer hi-hat
         }
         if (beat_count % 4 == 2)
         {
-            audio_note_on(9, 0, 38, 0.35f); // Softer snare
+            timeline_note_on(tl, current_frame, 9, DRUM_KIT_PRESET, DRUM_SNARE, 0.35f); // Softer snare
         }
         if (beat_count % 16 == 0)
         {
-            audio_note_on(9, 0, 49, 0.3f); // Occasional ride/crash
+            timeline_note_on(tl, current_frame, 9, DRUM_KIT_PRESET, DRUM_CRASH, 0.3f); // Occasional ride/crash
         }
 
-        // Render in smaller chunks for smooth mixing
-        size_t chunk_size = duration_frames / 4;
-        for (int chunk = 0; chunk < 4; chunk++)
-        {
-            if (current_frame + chunk_size > total_frames)
-                chunk_size = total_frames - current_frame;
-            if (chunk_size > 0)
-            {
-                audio_render_samples(audio->buffer + current_frame * 2, chunk_size);
-                current_frame += chunk_size;
-            }
-        }
+        // Let the notes sound for the character's duration, rounded down to
+        // whole quarters as earlier releases did
+        advance(&current_frame, (duration_frames / 4) * 4, total_frames);
 
         beat_count++;
         if (c == ' ' || i % 8 == 7)
@@ -290,37 +267,100 @@ AudioData *encode_text(const char *text, const char *seed)
 
     // Clean release of all notes
     if (prev_melody_note != -1)
-        audio_note_off(0, prev_melody_note);
+        timeline_note_off(tl, current_frame, 0, prev_melody_note);
     if (prev_harmony_note != -1)
-        audio_note_off(1, prev_harmony_note);
+        timeline_note_off(tl, current_frame, 1, prev_harmony_note);
     if (prev_bass_note != -1)
-        audio_note_off(2, prev_bass_note);
+        timeline_note_off(tl, current_frame, 2, prev_bass_note);
     for (int j = 0; j < 4; j++)
     {
         if (prev_pad_notes[j] != -1)
-            audio_note_off(3, prev_pad_notes[j]);
+            timeline_note_off(tl, current_frame, 3, prev_pad_notes[j]);
     }
 
-    // Render a short tail for note decay (500ms instead of 2 seconds)
-    size_t tail_frames = 22050; // 0.5 seconds at 44100 Hz
-    size_t tail_rendered = 0;
-    while (tail_rendered < tail_frames && current_frame < total_frames)
+    // Short tail for note decay (500ms instead of 2 seconds)
+    advance(&current_frame, 22050, total_frames);
+
+    tl->frame_count = current_frame;
+    return !tl->oom;
+}
+
+size_t encode_frame_count(const char *text, const char *seed)
+{
+    Timeline tl;
+    timeline_init(&tl);
+    encode_compile(text, seed, &tl);
+    size_t frames = tl.frame_count;
+    timeline_free(&tl);
+    return frames;
+}
+
+AudioData *encode_text(sh_encoder *enc, const char *text, const char *seed)
+{
+    // The WAV's metadata could not carry a longer text
+    if (strlen(text) > AUDIO_MAX_TEXT)
+        return NULL;
+    Timeline tl;
+    timeline_init(&tl);
+    if (!encode_compile(text, seed, &tl))
     {
-        size_t render = tail_frames - tail_rendered;
-        if (render > 4410)
-            render = 4410;
-        if (current_frame + render > total_frames)
-            render = total_frames - current_frame;
-        if (render == 0)
-            break;
-
-        audio_render_samples(audio->buffer + current_frame * 2, render);
-        current_frame += render;
-        tail_rendered += render;
+        timeline_free(&tl);
+        return NULL;
     }
+    // The seed has picked its instruments: start reading their samples in
+    // while the buffer is set up
+    timeline_prefetch(enc, &tl);
 
-    // Trim total frames to actual content (remove excess silence)
-    audio->frame_count = current_frame;
+    AudioData *audio = malloc(sizeof(AudioData));
+    if (!audio)
+    {
+        timeline_free(&tl);
+        return NULL;
+    }
+
+    audio->buffer = calloc(tl.frame_count * 2, sizeof(int16_t));
+    audio->frame_count = tl.frame_count;
+    audio->sample_rate = 44100;
+
+    if (!audio->buffer)
+    {
+        free(audio);
+        timeline_free(&tl);
+        return NULL;
+    }
 
+    timeline_render_into(enc, &tl, audio->buffer);
+    timeline_free(&tl);
     return audio;
 }
+
+static int write_to_stream(void *ctx, const int16_t *pcm, size_t frames)
+{
+    return fwrite(pcm, 4, frames, (FILE *)ctx) == frames;
+}
+
+int encode_text_stream(sh_encoder *enc, FILE *out, const char *text, const char *seed, size_t *frames)
+{
+    if (strlen(text) > AUDIO_MAX_TEXT)
+        return 0;
+    // Composing is cheap and fixes the exact length, so the header goes out
+    // before any audio is rendered
+    Timeline tl;
+    timeline_init(&tl);
+    if (!encode_compile(text, seed, &tl))
+    {
+        timeline_free(&tl);
+        return 0;
+    }
+    timeline_prefetch(enc, &tl);
+
+    uint32_t seed_hash = hash_seed(seed);
+    int ok = audio_write_wav_header(out, tl.frame_count, text, seed_hash, AUDIO_WAV_V2) && fflush(out) == 0 &&
+             timeline_render(enc, &tl, write_to_stream, out) &&
+             audio_write_wav_trailer(out, text, seed_hash, AUDIO_WAV_V2) && fflush(out) == 0;
+
+    if (frames)
+        *frames = tl.frame_count;
+    timeline_free(&tl);
+    return ok;
+}
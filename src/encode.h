@@ -3,9 +3,20 @@
 
 #include <stdint.h>
 #include "audio.h"
+#include "timeline.h"
 
 char *normalize_text(const char *input);
 uint32_t hash_seed(const char *seed);
-AudioData *encode_text(const char *text, const char *seed);
+// Composes text/seed into tl (which must be initialized) without touching a
+// synth. Returns 0 if memory ran out.
+int encode_compile(const char *text, const char *seed, Timeline *tl);
+// Returns NULL for texts longer than AUDIO_MAX_TEXT, before rendering
+AudioData *encode_text(sh_encoder *enc, const char *text, const char *seed);
+// Exact frame count of the track encode_text() would produce, without rendering
+size_t encode_frame_count(const char *text, const char *seed);
+// Writes the WAV for text/seed to out in fixed-size blocks as it renders;
+// memory use does not depend on the text length. Returns 0 on failure,
+// and for texts longer than AUDIO_MAX_TEXT before writing anything.
+int encode_text_stream(sh_encoder *enc, FILE *out, const char *text, const char *seed, size_t *frames);
 
 #endif
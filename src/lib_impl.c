@@ -1,2 +0,0 @@
-#define TSF_IMPLEMENTATION
-#include "tsf.h"
@@ -3,6 +3,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <glob.h>
+#include <strings.h>
+#include <math.h>
+#include <sys/stat.h>
 #include "audio.h"
 #include "encode.h"
 
@@ -10,11 +16,58 @@ static void print_usage(void)
 {
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "  stringheat -s <seed> -e <text>       Encode text to WAV (stdout)\n");
-    fprintf(stderr, "  stringheat -s <seed> -d <file>       Decode WAV file\n");
+    fprintf(stderr, "  stringheat -s <seed> -d <file>       Decode WAV file ('-' for stdin)\n");
     fprintf(stderr, "  stringheat -r                        Generate random music (stdout)\n");
+    fprintf(stderr, "  stringheat -b <manifest> [-j <n>]    Batch encode jobs from manifest ('-' for stdin)\n");
+    fprintf(stderr, "                                       on n threads (0 = one per CPU)\n");
+    fprintf(stderr, "  stringheat -s <seed> -D <src> [-j <n>]\n");
+    fprintf(stderr, "                                       Decode a directory tree, glob or path list\n");
+    fprintf(stderr, "                                       ('-' for stdin) to JSON lines on stdout\n");
+    fprintf(stderr, "  -S (with -e, -r or -b)               Print synth statistics to stderr\n");
+    fprintf(stderr, "  -f <font> (with -e, -r or -b)        Use an SF2 file (or font image) instead of the\n");
+    fprintf(stderr, "                                       embedded soundfont\n");
+    fprintf(stderr, "  -C (with -f)                         Share the parsed font with other processes\n");
+    fprintf(stderr, "  -p <voices> (with -e, -r or -b)      Polyphony cap per encoder (default 256)\n");
+    fprintf(stderr, "  -c <lsb> (with -e, -r or -b)         Cull voices quieter than this many 16-bit LSBs\n");
+    fprintf(stderr, "                                       (default 1; 0 renders every voice)\n");
+    fprintf(stderr, "  -V (with -e, -r or -b)               Render voices in SIMD lane groups (voice bank)\n");
+    fprintf(stderr, "  -R <ch>:<n>[,...] (with -e, -r or -b)\n");
+    fprintf(stderr, "                                       Render channel ch at 1/n rate (n = 2 or 4) and\n");
+    fprintf(stderr, "                                       upsample it, e.g. -R 2:4,3:2 for bass and pads\n");
+    fprintf(stderr, "\nManifest lines: <seed>\\t<text>\\t<output path> (blank lines and '#' comments skipped)\n");
     exit(1);
 }
 
+// Parses -c's LSB count: a finite number, 0 (AUDIO_CULL_OFF) or more
+static int parse_cull_threshold(const char *arg, float *threshold)
+{
+    char *end;
+    float value = strtof(arg, &end);
+    if (end == arg || *end || !(value >= 0.0f) || isinf(value))
+        return 0;
+    *threshold = value;
+    return 1;
+}
+
+// Parses -R's comma-separated <channel>:<divisor> pairs into rates
+static int parse_channel_rates(const char *spec, int *rates)
+{
+    while (*spec)
+    {
+        char *end;
+        long channel = strtol(spec, &end, 10);
+        if (end == spec || *end != ':' || channel < 0 || channel >= AUDIO_CHANNELS)
+            return 0;
+        spec = end + 1;
+        long divisor = strtol(spec, &end, 10);
+        if (end == spec || (divisor != 1 && divisor != 2 && divisor != 4) || (*end != ',' && *end != '\0'))
+            return 0;
+        rates[channel] = (int)divisor;
+        spec = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
 static void generate_random_text(char *buffer, int length)
 {
     const char *words[] = {
@@ -44,15 +97,537 @@ static void generate_random_text(char *buffer, int length)
     buffer[pos] = '\0';
 }
 
+typedef struct
+{
+    char *seed;
+    char *text;
+    char *output;
+    size_t frames;
+    double seconds;
+    int ok;
+} BatchJob;
+
+typedef struct
+{
+    sh_engine *engine;
+    BatchJob *jobs;
+    size_t count;
+    size_t next;
+    int show_stats;
+    AudioStats stats;
+    pthread_mutex_t stats_lock;
+} BatchQueue;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void free_batch_jobs(BatchJob *jobs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        free(jobs[i].seed);
+        free(jobs[i].text);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+// Parse "<seed>\t<text>\t<output>" lines. Text is normalized here so every
+// job is validated before the soundfont is loaded.
+static BatchJob *read_batch_manifest(const char *path, size_t *count)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot open manifest '%s'\n", path);
+        return NULL;
+    }
+
+    BatchJob *jobs = NULL;
+    size_t job_count = 0, job_cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    size_t line_no = 0;
+    int ok = 1;
+
+    while ((line_len = getline(&line, &line_cap, f)) != -1)
+    {
+        line_no++;
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+            line[--line_len] = '\0';
+        if (line_len == 0 || line[0] == '#')
+            continue;
+
+        char *text = strchr(line, '\t');
+        char *output = text ? strchr(text + 1, '\t') : NULL;
+        if (!output || output[1] == '\0' || text == line)
+        {
+            fprintf(stderr, "Error: %s:%zu: expected <seed>\\t<text>\\t<output>\n", path, line_no);
+            ok = 0;
+            break;
+        }
+        *text++ = '\0';
+        *output++ = '\0';
+
+        if (job_count == job_cap)
+        {
+            size_t new_cap = job_cap ? job_cap * 2 : 64;
+            BatchJob *grown = realloc(jobs, new_cap * sizeof(BatchJob));
+            if (!grown)
+            {
+                ok = 0;
+                break;
+            }
+            jobs = grown;
+            job_cap = new_cap;
+        }
+
+        BatchJob *job = &jobs[job_count];
+        job->seed = strdup(line);
+        job->text = normalize_text(text);
+        job->output = strdup(output);
+        job->frames = 0;
+        job->seconds = 0.0;
+        job->ok = 0;
+        job_count++;
+        if (!job->seed || !job->text || !job->output)
+        {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            ok = 0;
+            break;
+        }
+        if (strlen(job->text) > AUDIO_MAX_TEXT)
+        {
+            fprintf(stderr, "Error: %s:%zu: text longer than %d characters\n", path, line_no, AUDIO_MAX_TEXT);
+            ok = 0;
+            break;
+        }
+    }
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+
+    if (!ok)
+    {
+        free_batch_jobs(jobs, job_count);
+        return NULL;
+    }
+    *count = job_count;
+    return jobs;
+}
+
+static int encode_to_file(sh_encoder *enc, const char *text, const char *seed, const char *path, size_t *frames)
+{
+    FILE *out = fopen(path, "wb");
+    if (!out)
+        return 0;
+    int ok = encode_text_stream(enc, out, text, seed, frames);
+    if (fclose(out) != 0)
+        ok = 0;
+    return ok;
+}
+
+static void print_stats(const AudioStats *stats)
+{
+    double audio_seconds = stats->frames_rendered / 44100.0;
+    fprintf(stderr, "Render: %llu calls for %.2f s audio (%.1f calls per audio second)\n",
+            (unsigned long long)stats->render_calls, audio_seconds,
+            audio_seconds > 0 ? stats->render_calls / audio_seconds : 0.0);
+    fprintf(stderr, "Voices: peak %u, average %.1f, %llu stolen, %llu culled\n", stats->peak_voices,
+            stats->frames_rendered ? (double)stats->voice_frames / stats->frames_rendered : 0.0,
+            (unsigned long long)stats->voices_stolen, (unsigned long long)stats->voices_culled);
+    fprintf(stderr, "Kernels:");
+    const char *separator = " ";
+    for (int k = 0; k < AUDIO_VOICE_KERNELS; k++)
+        if (stats->voice_kernels[k])
+        {
+            fprintf(stderr, "%s%s %llu", separator, audio_voice_kernel_name(k),
+                    (unsigned long long)stats->voice_kernels[k]);
+            separator = ", ";
+        }
+    fprintf(stderr, "\n");
+}
+
+static int encode_to_stdout(const char *text, const char *seed, const AudioOptions *options, int show_stats)
+{
+    sh_engine *engine = audio_init_with(options);
+    sh_encoder *enc = audio_encoder_create(engine);
+    if (!enc)
+    {
+        fprintf(stderr, "Error: Failed to load soundfont\n");
+        audio_cleanup(engine);
+        return 0;
+    }
+
+    size_t frames = 0;
+    int ok = encode_text_stream(enc, stdout, text, seed, &frames);
+
+    if (show_stats)
+    {
+        AudioStats stats;
+        audio_encoder_stats(enc, &stats);
+        print_stats(&stats);
+    }
+
+    audio_encoder_destroy(enc);
+    audio_cleanup(engine);
+    return ok;
+}
+
+static void run_batch_jobs(BatchQueue *queue)
+{
+    sh_encoder *enc = audio_encoder_create(queue->engine);
+    if (!enc)
+    {
+        fprintf(stderr, "Error: Failed to create encoder\n");
+        return;
+    }
+
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->count)
+            break;
+
+        BatchJob *job = &queue->jobs[i];
+        double job_start = now_seconds();
+        job->ok = audio_encoder_reset(enc) &&
+                  encode_to_file(enc, job->text, job->seed, job->output, &job->frames);
+        job->seconds = now_seconds() - job_start;
+
+        double audio_seconds = job->frames / 44100.0;
+        char voices[64] = "";
+        if (queue->show_stats)
+        {
+            AudioStats stats;
+            audio_encoder_job_stats(enc, &stats);
+            snprintf(voices, sizeof(voices), ", voices peak %u avg %.1f", stats.peak_voices,
+                     stats.frames_rendered ? (double)stats.voice_frames / stats.frames_rendered : 0.0);
+        }
+        if (job->ok)
+            fprintf(stderr, "[%zu/%zu] %s: %zu chars, %.2f s audio in %.1f ms (%.1fx realtime%s)\n",
+                    i + 1, queue->count, job->output, strlen(job->text), audio_seconds,
+                    job->seconds * 1000.0, job->seconds > 0 ? audio_seconds / job->seconds : 0.0, voices);
+        else
+            fprintf(stderr, "[%zu/%zu] %s: Error: Encoding failed\n", i + 1, queue->count, job->output);
+    }
+
+    AudioStats stats;
+    audio_encoder_stats(enc, &stats);
+    pthread_mutex_lock(&queue->stats_lock);
+    audio_stats_add(&queue->stats, &stats);
+    pthread_mutex_unlock(&queue->stats_lock);
+
+    audio_encoder_destroy(enc);
+}
+
+static void *batch_worker(void *arg)
+{
+    run_batch_jobs(arg);
+    return NULL;
+}
+
+// Runs worker(arg) on the given number of threads and waits for all of them.
+// Workers that cannot be started are replaced by running on this thread.
+static void run_workers(int threads, void *(*worker)(void *), void *arg)
+{
+    pthread_t *workers = threads > 1 ? malloc(threads * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    if (workers)
+    {
+        while (started < threads && pthread_create(&workers[started], NULL, worker, arg) == 0)
+            started++;
+    }
+    if (started < threads)
+        worker(arg);
+    for (int t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
+    free(workers);
+}
+
+static int run_batch(const char *manifest, const AudioOptions *options, int threads, int show_stats)
+{
+    size_t job_count = 0;
+    BatchJob *jobs = read_batch_manifest(manifest, &job_count);
+    if (!jobs)
+        return 1;
+
+    double start = now_seconds();
+    sh_engine *engine = audio_init_with(options);
+    double load_time = now_seconds() - start;
+    if (!engine)
+    {
+        fprintf(stderr, "Error: Failed to load soundfont\n");
+        free_batch_jobs(jobs, job_count);
+        return 1;
+    }
+
+    BatchQueue queue = {engine, jobs, job_count, 0, show_stats, {0}, PTHREAD_MUTEX_INITIALIZER};
+    run_workers(threads, batch_worker, &queue);
+
+    size_t failed = 0;
+    double total_audio = 0.0;
+    for (size_t i = 0; i < job_count; i++)
+    {
+        if (jobs[i].ok)
+            total_audio += jobs[i].frames / 44100.0;
+        else
+            failed++;
+    }
+
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "Batch: %zu jobs (%zu failed) on %d thread%s, %.2f s audio in %.3f s "
+                    "(%.1f jobs/s, %.1fx realtime, soundfont load %.1f ms)\n",
+            job_count, failed, threads, threads == 1 ? "" : "s", total_audio, elapsed,
+            elapsed > 0 ? job_count / elapsed : 0.0,
+            elapsed > 0 ? total_audio / elapsed : 0.0, load_time * 1000.0);
+    if (show_stats)
+        print_stats(&queue.stats);
+
+    audio_cleanup(engine);
+    free_batch_jobs(jobs, job_count);
+    return failed ? 1 : 0;
+}
+
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t cap;
+} PathList;
+
+static int path_list_add(PathList *list, const char *path)
+{
+    if (list->count == list->cap)
+    {
+        size_t new_cap = list->cap ? list->cap * 2 : 256;
+        char **grown = realloc(list->paths, new_cap * sizeof(char *));
+        if (!grown)
+            return 0;
+        list->paths = grown;
+        list->cap = new_cap;
+    }
+    list->paths[list->count] = strdup(path);
+    if (!list->paths[list->count])
+        return 0;
+    list->count++;
+    return 1;
+}
+
+static void path_list_free(PathList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+        free(list->paths[i]);
+    free(list->paths);
+}
+
+static int is_wav_name(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcasecmp(name + len - 4, ".wav") == 0;
+}
+
+static int collect_dir(PathList *list, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        fprintf(stderr, "Warning: Cannot open directory '%s'\n", dir);
+        return 1;
+    }
+
+    int ok = 1;
+    struct dirent *entry;
+    while (ok && (entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        size_t len = strlen(dir) + strlen(entry->d_name) + 2;
+        char *path = malloc(len);
+        if (!path)
+        {
+            ok = 0;
+            break;
+        }
+        snprintf(path, len, "%s/%s", dir, entry->d_name);
+
+        // Symlinked directories are not followed, so links back up the tree
+        // cannot loop; symlinked files are decoded like regular ones
+        struct stat st;
+        int found = lstat(path, &st) == 0;
+        if (found && S_ISLNK(st.st_mode))
+            found = stat(path, &st) == 0 && !S_ISDIR(st.st_mode);
+        if (found)
+        {
+            if (S_ISDIR(st.st_mode))
+                ok = collect_dir(list, path);
+            else if (S_ISREG(st.st_mode) && is_wav_name(entry->d_name))
+                ok = path_list_add(list, path);
+        }
+        free(path);
+    }
+
+    closedir(d);
+    return ok;
+}
+
+// A source is a directory (searched recursively for *.wav), a glob pattern,
+// or a file with one path per line ('-' for stdin).
+static int collect_paths(PathList *list, const char *source)
+{
+    struct stat st;
+    if (strcmp(source, "-") != 0 && stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+        return collect_dir(list, source);
+
+    if (strpbrk(source, "*?["))
+    {
+        glob_t g;
+        int rc = glob(source, 0, NULL, &g);
+        if (rc == GLOB_NOMATCH)
+            return 1;
+        if (rc != 0)
+            return 0;
+        int ok = 1;
+        for (size_t i = 0; ok && i < g.gl_pathc; i++)
+            ok = path_list_add(list, g.gl_pathv[i]);
+        globfree(&g);
+        return ok;
+    }
+
+    FILE *f = strcmp(source, "-") == 0 ? stdin : fopen(source, "r");
+    if (!f)
+    {
+        fprintf(stderr, "Error: Cannot open '%s'\n", source);
+        return 0;
+    }
+
+    int ok = 1;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while (ok && (line_len = getline(&line, &line_cap, f)) != -1)
+    {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+            line[--line_len] = '\0';
+        if (line_len > 0)
+            ok = path_list_add(list, line);
+    }
+    free(line);
+    if (f != stdin)
+        fclose(f);
+    return ok;
+}
+
+static void print_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+typedef struct
+{
+    PathList *files;
+    uint32_t seed_hash;
+    size_t next;
+    size_t decoded;
+    uint64_t bytes_read;
+} DecodeQueue;
+
+static void *decode_worker(void *arg)
+{
+    DecodeQueue *queue = arg;
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->files->count)
+            break;
+
+        const char *path = queue->files->paths[i];
+        char *text = NULL;
+        uint64_t bytes_read = 0;
+        int status = audio_decode_file(path, queue->seed_hash, &text, &bytes_read);
+
+        __atomic_fetch_add(&queue->bytes_read, bytes_read, __ATOMIC_RELAXED);
+        if (status == AUDIO_DECODE_OK)
+            __atomic_fetch_add(&queue->decoded, 1, __ATOMIC_RELAXED);
+
+        // One record per line; keep concurrent records from interleaving
+        flockfile(stdout);
+        fputs("{\"path\":", stdout);
+        print_json_string(stdout, path);
+        fprintf(stdout, ",\"status\":\"%s\"", audio_decode_status_name(status));
+        if (text)
+        {
+            fputs(",\"text\":", stdout);
+            print_json_string(stdout, text);
+        }
+        fputs("}\n", stdout);
+        funlockfile(stdout);
+
+        free(text);
+    }
+    return NULL;
+}
+
+static int run_batch_decode(const char *source, const char *seed, int threads)
+{
+    double start = now_seconds();
+
+    PathList files = {NULL, 0, 0};
+    if (!collect_paths(&files, source))
+    {
+        fprintf(stderr, "Error: Failed to list files from '%s'\n", source);
+        path_list_free(&files);
+        return 1;
+    }
+
+    DecodeQueue queue = {&files, hash_seed(seed), 0, 0, 0};
+    run_workers(threads, decode_worker, &queue);
+    fflush(stdout);
+
+    double elapsed = now_seconds() - start;
+    fprintf(stderr, "Decode: %zu files (%zu decoded, %zu failed) on %d thread%s in %.3f s "
+                    "(%.1f files/s, %llu bytes read, %.1f bytes/file)\n",
+            files.count, queue.decoded, files.count - queue.decoded, threads, threads == 1 ? "" : "s",
+            elapsed, elapsed > 0 ? files.count / elapsed : 0.0, (unsigned long long)queue.bytes_read,
+            files.count ? (double)queue.bytes_read / files.count : 0.0);
+
+    int failed = queue.decoded != files.count;
+    path_list_free(&files);
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
     char *seed = NULL;
     char *input_text = NULL;
     char *decode_file = NULL;
+    char *batch_manifest = NULL;
+    char *batch_decode = NULL;
+    AudioOptions options = {NULL, 0, 0, AUDIO_DEFAULT_CULL_LSB, AUDIO_ENGINE_VOICES};
     int random_mode = 0;
+    int threads = 1;
+    int show_stats = 0;
     int opt;
 
-    while ((opt = getopt(argc, argv, "s:e:d:r")) != -1)
+    while ((opt = getopt(argc, argv, "s:e:d:rb:D:j:Sf:Cp:c:VR:")) != -1)
     {
         switch (opt)
         {
@@ -68,6 +643,44 @@ int main(int argc, char **argv)
         case 'r':
             random_mode = 1;
             break;
+        case 'b':
+            batch_manifest = optarg;
+            break;
+        case 'S':
+            show_stats = 1;
+            break;
+        case 'f':
+            options.soundfont_path = optarg;
+            break;
+        case 'C':
+            options.shared_cache = 1;
+            break;
+        case 'p':
+            options.max_voices = atoi(optarg);
+            if (options.max_voices < 1)
+                print_usage();
+            break;
+        case 'c':
+            if (!parse_cull_threshold(optarg, &options.cull_threshold))
+                print_usage();
+            break;
+        case 'V':
+            options.engine = AUDIO_ENGINE_BANK;
+            break;
+        case 'R':
+            if (!parse_channel_rates(optarg, options.channel_rate))
+                print_usage();
+            break;
+        case 'D':
+            batch_decode = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1)
+                threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (threads < 1)
+                threads = 1;
+            break;
         default:
             print_usage();
         }
@@ -95,35 +708,31 @@ int main(int argc, char **argv)
         fprintf(stderr, "  Length: %d chars\n", (int)strlen(random_text));
         fprintf(stderr, "  Seed: %s\n", random_seed);
 
-        audio_init("soundfont.sf2");
-        AudioData *audio = encode_text(random_text, random_seed);
-
-        if (!audio)
+        if (!encode_to_stdout(random_text, random_seed, &options, show_stats))
         {
             fprintf(stderr, "Error: Encoding failed\n");
-            audio_cleanup();
             free(random_text);
             return 1;
         }
 
-        uint32_t seed_hash = hash_seed(random_seed);
-        audio_write_wav(random_text, seed_hash, audio);
-
         fprintf(stderr, "Done\n");
 
-        free(audio->buffer);
-        free(audio);
         free(random_text);
-        audio_cleanup();
         return 0;
     }
 
+    if (batch_manifest)
+        return run_batch(batch_manifest, &options, threads, show_stats);
+
     if (!seed)
     {
         fprintf(stderr, "Error: Seed required\n");
         print_usage();
     }
 
+    if (batch_decode)
+        return run_batch_decode(batch_decode, seed, threads);
+
     if (input_text && decode_file)
     {
         fprintf(stderr, "Error: Cannot encode and decode simultaneously\n");
@@ -145,28 +754,25 @@ int main(int argc, char **argv)
             return 1;
         }
 
-        fprintf(stderr, "Encoding: '%s' (%zu chars)\n", normalized, strlen(normalized));
+        if (strlen(normalized) > AUDIO_MAX_TEXT)
+        {
+            fprintf(stderr, "Error: Text longer than %d characters\n", AUDIO_MAX_TEXT);
+            free(normalized);
+            return 1;
+        }
 
-        audio_init("soundfont.sf2");
-        AudioData *audio = encode_text(normalized, seed);
+        fprintf(stderr, "Encoding: '%s' (%zu chars)\n", normalized, strlen(normalized));
 
-        if (!audio)
+        if (!encode_to_stdout(normalized, seed, &options, show_stats))
         {
             fprintf(stderr, "Error: Encoding failed\n");
-            audio_cleanup();
             free(normalized);
             return 1;
         }
 
-        uint32_t seed_hash = hash_seed(seed);
-        audio_write_wav(normalized, seed_hash, audio);
-
         fprintf(stderr, "Done\n");
 
-        free(audio->buffer);
-        free(audio);
         free(normalized);
-        audio_cleanup();
     }
     else if (decode_file)
     {
@@ -0,0 +1,29 @@
+#ifndef PRESETS_H
+#define PRESETS_H
+
+#include <stdint.h>
+
+// Every preset and drum note the composer can select. encode.c picks its
+// instruments from these tables, and the build prunes the embedded soundfont
+// to exactly this set (see src/sfimage.c), so the two cannot drift apart.
+
+// Bank 0 (melodic)
+static const int melody_presets[] = {0, 24, 73, 11};
+#define MELODY_PRESET_COUNT 4
+static const int harmony_presets[] = {0, 4, 48}; // Piano, EP, Strings
+#define HARMONY_PRESET_COUNT 3
+#define BASS_PRESET_FIRST 32
+#define BASS_PRESET_COUNT 4
+#define PAD_PRESET_FIRST 88
+#define PAD_PRESET_COUNT 8
+
+// Bank 128 (drum kit on channel 9)
+#define DRUM_KIT_PRESET 0
+#define DRUM_KICK 36
+#define DRUM_SNARE 38
+#define DRUM_HIHAT 42
+#define DRUM_CRASH 49
+static const uint8_t drum_notes[] = {DRUM_KICK, DRUM_SNARE, DRUM_HIHAT, DRUM_CRASH};
+#define DRUM_NOTE_COUNT 4
+
+#endif
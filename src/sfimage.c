@@ -0,0 +1,113 @@
+#include "synth.h"
+#include "presets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Build tool: parses an SF2 file once and writes the font image that the
+// binary embeds, so startup never parses or converts the soundfont. With -p
+// the image keeps only what encode.c can play (src/presets.h); with -z the
+// sample pool is stored compressed.
+
+static unsigned char *read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char *data = len > 0 ? malloc(len) : NULL;
+    if (!data || fread(data, 1, len, f) != (size_t)len)
+    {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *size = (size_t)len;
+    return data;
+}
+
+static SynthFont *prune_to_composer(SynthFont *font)
+{
+    SynthPresetFilter keep[MELODY_PRESET_COUNT + HARMONY_PRESET_COUNT + BASS_PRESET_COUNT + PAD_PRESET_COUNT + 1];
+    int count = 0;
+
+    for (int i = 0; i < MELODY_PRESET_COUNT; i++)
+        keep[count++] = (SynthPresetFilter){0, melody_presets[i], NULL, 0};
+    for (int i = 0; i < HARMONY_PRESET_COUNT; i++)
+        keep[count++] = (SynthPresetFilter){0, harmony_presets[i], NULL, 0};
+    for (int i = 0; i < BASS_PRESET_COUNT; i++)
+        keep[count++] = (SynthPresetFilter){0, BASS_PRESET_FIRST + i, NULL, 0};
+    for (int i = 0; i < PAD_PRESET_COUNT; i++)
+        keep[count++] = (SynthPresetFilter){0, PAD_PRESET_FIRST + i, NULL, 0};
+    keep[count++] = (SynthPresetFilter){128, DRUM_KIT_PRESET, drum_notes, DRUM_NOTE_COUNT};
+
+    for (int i = 0; i < count; i++)
+        if (synth_font_find_preset(font, keep[i].bank, keep[i].preset) < 0)
+            fprintf(stderr, "Warning: Soundfont has no preset %d:%d\n", keep[i].bank, keep[i].preset);
+
+    SynthFont *pruned = synth_font_prune(font, keep, count);
+    synth_font_free(font);
+    return pruned;
+}
+
+int main(int argc, char *argv[])
+{
+    int prune = 0, samples = SYNTH_IMAGE_RAW;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "-p") == 0)
+            prune = 1;
+        else if (strcmp(argv[arg], "-z") == 0)
+            samples = SYNTH_IMAGE_COMPRESSED;
+        else
+            break;
+    }
+    if (argc - arg != 2)
+    {
+        fprintf(stderr, "Usage: %s [-p] [-z] <soundfont.sf2> <image.bin>\n", argv[0]);
+        return 1;
+    }
+    const char *input = argv[arg];
+    const char *output = argv[arg + 1];
+
+    size_t size;
+    unsigned char *data = read_file(input, &size);
+    if (!data)
+    {
+        fprintf(stderr, "Error: Cannot read '%s'\n", input);
+        return 1;
+    }
+
+    // The font reads its samples from data, which is freed last
+    SynthFont *font = synth_font_load_sf2(data, size);
+    if (font && prune)
+        font = prune_to_composer(font);
+    if (!font)
+    {
+        fprintf(stderr, "Error: '%s' is not a valid SF2 soundfont\n", input);
+        free(data);
+        return 1;
+    }
+
+    FILE *out = fopen(output, "wb");
+    int ok = out && synth_font_write_image(font, out, samples);
+    if (out && fclose(out) != 0)
+        ok = 0;
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Cannot write '%s'\n", output);
+        synth_font_free(font);
+        free(data);
+        return 1;
+    }
+
+    printf("Font image: %u presets, %u regions, %u samples\n", font->preset_count, font->region_count,
+           font->sample_count);
+    synth_font_free(font);
+    free(data);
+    return 0;
+}
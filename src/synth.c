@@ -0,0 +1,2537 @@
+#include "synth.h"
+#include "synth_kernels.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define SYNTH_CHANNELS 16
+#define SYNTH_FAST_RELEASE 0.01f
+// Frames mixed in float before conversion to 16-bit
+#define SYNTH_OUTPUT_BLOCK 1024
+// Samples per cache line: repacked sample spans start on one, and the
+// renderer prefetches ahead in steps of one
+#define CACHE_LINE_SAMPLES (64 / sizeof(int16_t))
+
+// SF2 generator operators used by the loader
+enum
+{
+    GEN_START_OFFSET = 0,
+    GEN_END_OFFSET = 1,
+    GEN_STARTLOOP_OFFSET = 2,
+    GEN_ENDLOOP_OFFSET = 3,
+    GEN_START_COARSE_OFFSET = 4,
+    GEN_MOD_LFO_TO_PITCH = 5,
+    GEN_VIB_LFO_TO_PITCH = 6,
+    GEN_MOD_ENV_TO_PITCH = 7,
+    GEN_INITIAL_FILTER_FC = 8,
+    GEN_INITIAL_FILTER_Q = 9,
+    GEN_MOD_LFO_TO_FILTER_FC = 10,
+    GEN_MOD_ENV_TO_FILTER_FC = 11,
+    GEN_END_COARSE_OFFSET = 12,
+    GEN_MOD_LFO_TO_VOLUME = 13,
+    GEN_PAN = 17,
+    GEN_DELAY_MOD_LFO = 21,
+    GEN_FREQ_MOD_LFO = 22,
+    GEN_DELAY_VIB_LFO = 23,
+    GEN_FREQ_VIB_LFO = 24,
+    GEN_DELAY_MOD_ENV = 25, // through GEN_KEYNUM_TO_MOD_ENV_DECAY = 32
+    GEN_DELAY_VOL_ENV = 33, // through GEN_KEYNUM_TO_VOL_ENV_DECAY = 40
+    GEN_SUSTAIN_VOL_ENV = 37,
+    GEN_INSTRUMENT = 41,
+    GEN_KEY_RANGE = 43,
+    GEN_VEL_RANGE = 44,
+    GEN_STARTLOOP_COARSE_OFFSET = 45,
+    GEN_KEYNUM = 46,
+    GEN_VELOCITY = 47,
+    GEN_INITIAL_ATTENUATION = 48,
+    GEN_ENDLOOP_COARSE_OFFSET = 50,
+    GEN_COARSE_TUNE = 51,
+    GEN_FINE_TUNE = 52,
+    GEN_SAMPLE_ID = 53,
+    GEN_SAMPLE_MODES = 54,
+    GEN_SCALE_TUNING = 56,
+    GEN_EXCLUSIVE_CLASS = 57,
+    GEN_OVERRIDING_ROOT_KEY = 58,
+    GEN_COUNT = 61
+};
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float timecents_to_seconds(float tc)
+{
+    return tc < -11950.0f ? 0.0f : powf(2.0f, tc / 1200.0f);
+}
+
+static float cents_to_hertz(float cents)
+{
+    return 8.176f * powf(2.0f, cents / 1200.0f);
+}
+
+static float decibels_to_gain(float db)
+{
+    return db > -100.0f ? powf(10.0f, db * 0.05f) : 0.0f;
+}
+
+// ---------------------------------------------------------------------------
+// SF2 loading
+
+// Record sizes of the hydra sub-chunks
+enum
+{
+    PHDR_SIZE = 38,
+    BAG_SIZE = 4,
+    GEN_SIZE = 4,
+    INST_SIZE = 22,
+    SHDR_SIZE = 46
+};
+
+typedef struct
+{
+    const uint8_t *phdr, *pbag, *pgen, *inst, *ibag, *igen, *shdr;
+    uint32_t phdr_n, pbag_n, pgen_n, inst_n, ibag_n, igen_n, shdr_n;
+    const uint8_t *smpl;
+    uint32_t smpl_n;
+} Hydra;
+
+static void hydra_chunk(Hydra *h, const uint8_t *id, const uint8_t *body, uint32_t size)
+{
+#define HYDRA_CHUNK(name, rec)                \
+    if (memcmp(id, #name, 4) == 0)            \
+    {                                         \
+        h->name = body;                       \
+        h->name##_n = size / rec;             \
+        return;                               \
+    }
+    HYDRA_CHUNK(phdr, PHDR_SIZE)
+    HYDRA_CHUNK(pbag, BAG_SIZE)
+    HYDRA_CHUNK(pgen, GEN_SIZE)
+    HYDRA_CHUNK(inst, INST_SIZE)
+    HYDRA_CHUNK(ibag, BAG_SIZE)
+    HYDRA_CHUNK(igen, GEN_SIZE)
+    HYDRA_CHUNK(shdr, SHDR_SIZE)
+    HYDRA_CHUNK(smpl, 2)
+#undef HYDRA_CHUNK
+}
+
+// Finds the hydra and sample chunks of a RIFF sfbk file in place
+static int parse_riff(const uint8_t *data, size_t size, Hydra *h)
+{
+    memset(h, 0, sizeof(*h));
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "sfbk", 4) != 0)
+        return 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= size)
+    {
+        uint32_t len = rd32(data + pos + 4);
+        size_t body = pos + 8;
+        if (len > size - body)
+            len = (uint32_t)(size - body);
+
+        if (memcmp(data + pos, "LIST", 4) == 0 && len >= 4)
+        {
+            size_t sub = body + 4, list_end = body + len;
+            while (sub + 8 <= list_end)
+            {
+                uint32_t sub_len = rd32(data + sub + 4);
+                if (sub_len > list_end - sub - 8)
+                    break;
+                hydra_chunk(h, data + sub, data + sub + 8, sub_len);
+                sub += 8 + sub_len + (sub_len & 1);
+            }
+        }
+        pos = body + len + (len & 1);
+    }
+
+    // Every list ends with a terminal record
+    return h->phdr_n >= 2 && h->pbag_n >= 1 && h->pgen_n >= 1 && h->inst_n >= 2 && h->ibag_n >= 1 &&
+           h->igen_n >= 1 && h->shdr_n >= 2 && h->smpl_n > 0;
+}
+
+// Zone generator lists are [gen index of bag, gen index of next bag)
+static void zone_gens(const uint8_t *bags, uint32_t bag_n, uint32_t gen_n, uint32_t bag,
+                      uint32_t *from, uint32_t *to)
+{
+    *from = rd16(bags + bag * BAG_SIZE);
+    *to = bag + 1 < bag_n ? rd16(bags + (bag + 1) * BAG_SIZE) : gen_n;
+    if (*to > gen_n)
+        *to = gen_n;
+    if (*from > *to)
+        *from = *to;
+}
+
+static int zone_has_gen(const uint8_t *gens, uint32_t from, uint32_t to, int oper)
+{
+    for (uint32_t i = from; i < to; i++)
+        if (rd16(gens + i * GEN_SIZE) == oper)
+            return 1;
+    return 0;
+}
+
+static void apply_gens(int *g, const uint8_t *gens, uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; i++)
+    {
+        const uint8_t *rec = gens + i * GEN_SIZE;
+        uint16_t oper = rd16(rec);
+        if (oper >= GEN_COUNT)
+            continue;
+        if (oper == GEN_KEY_RANGE || oper == GEN_VEL_RANGE || oper == GEN_INSTRUMENT || oper == GEN_SAMPLE_ID)
+            g[oper] = rd16(rec + 2);
+        else
+            g[oper] = (int16_t)rd16(rec + 2);
+    }
+}
+
+static void instrument_defaults(int *g)
+{
+    memset(g, 0, GEN_COUNT * sizeof(int));
+    g[GEN_INITIAL_FILTER_FC] = 13500;
+    g[GEN_DELAY_MOD_LFO] = -12000;
+    g[GEN_DELAY_VIB_LFO] = -12000;
+    for (int i = 0; i < 4; i++)
+    {
+        g[GEN_DELAY_MOD_ENV + i] = -12000;
+        g[GEN_DELAY_VOL_ENV + i] = -12000;
+    }
+    g[GEN_DELAY_MOD_ENV + 5] = -12000;
+    g[GEN_DELAY_VOL_ENV + 5] = -12000;
+    g[GEN_KEY_RANGE] = 127 << 8;
+    g[GEN_VEL_RANGE] = 127 << 8;
+    g[GEN_KEYNUM] = -1;
+    g[GEN_VELOCITY] = -1;
+    g[GEN_SCALE_TUNING] = 100;
+    g[GEN_OVERRIDING_ROOT_KEY] = -1;
+    g[GEN_INSTRUMENT] = -1;
+    g[GEN_SAMPLE_ID] = -1;
+}
+
+static void preset_defaults(int *g)
+{
+    memset(g, 0, GEN_COUNT * sizeof(int));
+    g[GEN_KEY_RANGE] = 127 << 8;
+    g[GEN_VEL_RANGE] = 127 << 8;
+    g[GEN_INSTRUMENT] = -1;
+}
+
+// Preset-level generators offset the instrument's values; ranges intersect
+// and sample-level generators are not allowed at preset level.
+static int merge_preset_gens(int *g, const int *pg)
+{
+    for (int i = 0; i < GEN_COUNT; i++)
+    {
+        switch (i)
+        {
+        case GEN_KEY_RANGE:
+        case GEN_VEL_RANGE:
+        {
+            int lo = (g[i] & 0xFF) > (pg[i] & 0xFF) ? (g[i] & 0xFF) : (pg[i] & 0xFF);
+            int hi = (g[i] >> 8) < (pg[i] >> 8) ? (g[i] >> 8) : (pg[i] >> 8);
+            if (lo > hi)
+                return 0;
+            g[i] = lo | (hi << 8);
+            break;
+        }
+        case GEN_START_OFFSET:
+        case GEN_END_OFFSET:
+        case GEN_STARTLOOP_OFFSET:
+        case GEN_ENDLOOP_OFFSET:
+        case GEN_START_COARSE_OFFSET:
+        case GEN_END_COARSE_OFFSET:
+        case GEN_STARTLOOP_COARSE_OFFSET:
+        case GEN_ENDLOOP_COARSE_OFFSET:
+        case GEN_INSTRUMENT:
+        case GEN_KEYNUM:
+        case GEN_VELOCITY:
+        case GEN_SAMPLE_ID:
+        case GEN_SAMPLE_MODES:
+        case GEN_EXCLUSIVE_CLASS:
+        case GEN_OVERRIDING_ROOT_KEY:
+            break;
+        default:
+            g[i] += pg[i];
+        }
+    }
+    return 1;
+}
+
+static void make_envelope(SynthEnvelope *e, const int *g, int first, int is_amp)
+{
+    e->delay = timecents_to_seconds((float)g[first]);
+    e->attack = timecents_to_seconds((float)g[first + 1]);
+    e->hold_tc = (float)g[first + 2];
+    e->decay_tc = (float)g[first + 3];
+    e->release = timecents_to_seconds((float)g[first + 5]);
+    e->keynum_to_hold = (float)g[first + 6];
+    e->keynum_to_decay = (float)g[first + 7];
+
+    int sustain = g[first + 4];
+    if (is_amp)
+        e->sustain = sustain <= 0 ? 1.0f : sustain >= 1440 ? 0.0f : decibels_to_gain(-sustain / 10.0f);
+    else
+        e->sustain = sustain <= 0 ? 1.0f : sustain >= 1000 ? 0.0f : 1.0f - sustain / 1000.0f;
+}
+
+static int64_t clamp_index(int64_t v, uint32_t max)
+{
+    return v < 0 ? 0 : v > max ? max : v;
+}
+
+static int make_region(SynthRegion *r, const int *g, const Hydra *h)
+{
+    if (g[GEN_SAMPLE_ID] < 0 || (uint32_t)g[GEN_SAMPLE_ID] + 1 >= h->shdr_n)
+        return 0;
+    const uint8_t *s = h->shdr + g[GEN_SAMPLE_ID] * SHDR_SIZE;
+    if (rd16(s + 44) & 0x8000) // ROM sample
+        return 0;
+
+    int64_t start = (int64_t)rd32(s + 20) + g[GEN_START_OFFSET] + 32768 * g[GEN_START_COARSE_OFFSET];
+    int64_t end = (int64_t)rd32(s + 24) + g[GEN_END_OFFSET] + 32768 * g[GEN_END_COARSE_OFFSET];
+    int64_t loop_start = (int64_t)rd32(s + 28) + g[GEN_STARTLOOP_OFFSET] + 32768 * g[GEN_STARTLOOP_COARSE_OFFSET];
+    int64_t loop_end = (int64_t)rd32(s + 32) + g[GEN_ENDLOOP_OFFSET] + 32768 * g[GEN_ENDLOOP_COARSE_OFFSET];
+    start = clamp_index(start, h->smpl_n);
+    end = clamp_index(end, h->smpl_n);
+    loop_start = clamp_index(loop_start, h->smpl_n);
+    loop_end = clamp_index(loop_end, h->smpl_n);
+    if (end <= start)
+        return 0;
+
+    memset(r, 0, sizeof(*r));
+    r->offset = (uint32_t)start;
+    r->end = (uint32_t)end;
+    r->loop_start = (uint32_t)loop_start;
+    r->loop_end = (uint32_t)loop_end;
+    r->sample_rate = rd32(s + 36);
+    if (r->sample_rate == 0)
+        r->sample_rate = 44100;
+
+    r->lokey = g[GEN_KEY_RANGE] & 0xFF;
+    r->hikey = g[GEN_KEY_RANGE] >> 8;
+    r->lovel = g[GEN_VEL_RANGE] & 0xFF;
+    r->hivel = g[GEN_VEL_RANGE] >> 8;
+
+    int mode = g[GEN_SAMPLE_MODES] & 3;
+    r->loop_mode = (mode == 1 || mode == 3) && loop_start < loop_end ? mode : SYNTH_LOOP_NONE;
+
+    int original_pitch = s[40];
+    int keycenter = g[GEN_OVERRIDING_ROOT_KEY] >= 0 ? g[GEN_OVERRIDING_ROOT_KEY] : original_pitch;
+    r->pitch_keycenter = keycenter <= 127 ? keycenter : 60;
+    r->transpose = g[GEN_COARSE_TUNE];
+    r->tune = g[GEN_FINE_TUNE] + (int8_t)s[41];
+    r->pitch_keytrack = g[GEN_SCALE_TUNING];
+    r->group = g[GEN_EXCLUSIVE_CLASS];
+
+    r->attenuation = g[GEN_INITIAL_ATTENUATION] * 0.1f;
+    r->pan = g[GEN_PAN] * 0.001f;
+    if (r->pan < -0.5f)
+        r->pan = -0.5f;
+    else if (r->pan > 0.5f)
+        r->pan = 0.5f;
+
+    make_envelope(&r->ampenv, g, GEN_DELAY_VOL_ENV, 1);
+    make_envelope(&r->modenv, g, GEN_DELAY_MOD_ENV, 0);
+
+    r->initial_filter_q = g[GEN_INITIAL_FILTER_Q];
+    r->initial_filter_fc = g[GEN_INITIAL_FILTER_FC];
+    r->mod_env_to_pitch = g[GEN_MOD_ENV_TO_PITCH];
+    r->mod_env_to_filter_fc = g[GEN_MOD_ENV_TO_FILTER_FC];
+    r->mod_lfo_to_pitch = g[GEN_MOD_LFO_TO_PITCH];
+    r->mod_lfo_to_filter_fc = g[GEN_MOD_LFO_TO_FILTER_FC];
+    r->mod_lfo_to_volume = g[GEN_MOD_LFO_TO_VOLUME];
+    r->vib_lfo_to_pitch = g[GEN_VIB_LFO_TO_PITCH];
+    r->delay_mod_lfo = timecents_to_seconds((float)g[GEN_DELAY_MOD_LFO]);
+    r->freq_mod_lfo = g[GEN_FREQ_MOD_LFO];
+    r->delay_vib_lfo = timecents_to_seconds((float)g[GEN_DELAY_VIB_LFO]);
+    r->freq_vib_lfo = g[GEN_FREQ_VIB_LFO];
+    return 1;
+}
+
+typedef struct
+{
+    SynthRegion *items;
+    uint32_t count, cap;
+} RegionList;
+
+static int region_list_push(RegionList *list, const SynthRegion *r)
+{
+    if (list->count == list->cap)
+    {
+        uint32_t new_cap = list->cap ? list->cap * 2 : 256;
+        SynthRegion *grown = realloc(list->items, new_cap * sizeof(SynthRegion));
+        if (!grown)
+            return 0;
+        list->items = grown;
+        list->cap = new_cap;
+    }
+    list->items[list->count++] = *r;
+    return 1;
+}
+
+// Expands one preset zone into regions, one per instrument zone it reaches
+static int add_preset_zone(RegionList *regions, const Hydra *h, const int *pg)
+{
+    int inst = pg[GEN_INSTRUMENT];
+    if (inst < 0 || (uint32_t)inst + 1 >= h->inst_n)
+        return 1;
+
+    uint32_t bag_from = rd16(h->inst + inst * INST_SIZE + 20);
+    uint32_t bag_to = rd16(h->inst + (inst + 1) * INST_SIZE + 20);
+    if (bag_to > h->ibag_n)
+        bag_to = h->ibag_n;
+
+    int global[GEN_COUNT];
+    instrument_defaults(global);
+
+    for (uint32_t bag = bag_from; bag < bag_to; bag++)
+    {
+        uint32_t from, to;
+        zone_gens(h->ibag, h->ibag_n, h->igen_n, bag, &from, &to);
+
+        // A first zone without a sample holds the instrument's defaults
+        if (!zone_has_gen(h->igen, from, to, GEN_SAMPLE_ID))
+        {
+            if (bag == bag_from)
+                apply_gens(global, h->igen, from, to);
+            continue;
+        }
+
+        int g[GEN_COUNT];
+        memcpy(g, global, sizeof(g));
+        apply_gens(g, h->igen, from, to);
+        if (!merge_preset_gens(g, pg))
+            continue;
+
+        SynthRegion r;
+        if (make_region(&r, g, h) && !region_list_push(regions, &r))
+            return 0;
+    }
+    return 1;
+}
+
+// Presets, regions and (unless samples is NULL, for a pool used in place)
+// the sample pool share one allocation
+static SynthFont *font_alloc(uint32_t preset_count, uint32_t region_count, uint32_t sample_count,
+                             SynthPreset **presets, SynthRegion **regions, int16_t **samples)
+{
+    size_t presets_size = (preset_count * sizeof(SynthPreset) + 63) & ~(size_t)63;
+    size_t regions_size = (region_count * sizeof(SynthRegion) + 63) & ~(size_t)63;
+    size_t samples_size = samples ? (size_t)sample_count * sizeof(int16_t) : 0;
+    SynthFont *font = malloc(sizeof(SynthFont));
+    uint8_t *block = aligned_alloc(64, (presets_size + regions_size + samples_size + 63) & ~(size_t)63);
+    if (!font || !block)
+    {
+        free(font);
+        free(block);
+        return NULL;
+    }
+
+    *presets = (SynthPreset *)block;
+    *regions = (SynthRegion *)(block + presets_size);
+    font->presets = *presets;
+    font->regions = *regions;
+    font->samples = NULL;
+    if (samples)
+    {
+        *samples = (int16_t *)(block + presets_size + regions_size);
+        font->samples = *samples;
+    }
+    font->preset_count = preset_count;
+    font->region_count = region_count;
+    font->sample_count = sample_count;
+    font->owned = block;
+    font->lazy = NULL;
+    font->lookup = NULL;
+    return font;
+}
+
+// ---------------------------------------------------------------------------
+// Note-on lookup
+
+// Built once per font so that note-on does not search: presets are found
+// through a small hash of (bank, preset), and each preset lists, per key,
+// the regions whose key range holds it (in region order, which is also the
+// order voices start in).
+typedef struct
+{
+    uint32_t slot_mask;
+    uint32_t *slots;       // preset index + 1, 0 for empty
+    uint32_t *key_first;   // per preset 129 offsets into key_regions
+    uint32_t *key_regions; // region indices
+} FontLookup;
+
+static uint32_t preset_hash(int bank, int preset)
+{
+    return ((uint32_t)bank << 16 | (uint16_t)preset) * 2654435761u;
+}
+
+static int font_build_lookup(SynthFont *font)
+{
+    uint32_t slot_count = 16;
+    while (slot_count < font->preset_count * 2)
+        slot_count *= 2;
+    size_t key_count = (size_t)font->preset_count * 129;
+    // One entry per key each preset's regions cover, counted the way they
+    // are filled in below: presets may share or overlap region ranges
+    size_t entry_count = 0;
+    for (uint32_t i = 0; i < font->preset_count; i++)
+    {
+        const SynthPreset *p = &font->presets[i];
+        for (uint32_t j = 0; j < p->region_count && p->region_index + j < font->region_count; j++)
+        {
+            const SynthRegion *r = &font->regions[p->region_index + j];
+            int hikey = r->hikey > 127 ? 127 : r->hikey;
+            if (r->lokey <= hikey)
+                entry_count += hikey - r->lokey + 1;
+        }
+    }
+
+    FontLookup *lookup = malloc(sizeof(FontLookup));
+    uint32_t *block = calloc(slot_count + key_count + entry_count + 1, sizeof(uint32_t));
+    if (!lookup || !block)
+    {
+        free(lookup);
+        free(block);
+        return 0;
+    }
+    lookup->slot_mask = slot_count - 1;
+    lookup->slots = block;
+    lookup->key_first = block + slot_count;
+    lookup->key_regions = block + slot_count + key_count;
+
+    for (uint32_t i = 0; i < font->preset_count; i++)
+    {
+        // The first of duplicate presets wins, as with a linear search
+        const SynthPreset *p = &font->presets[i];
+        uint32_t slot = preset_hash(p->bank, p->preset) & lookup->slot_mask;
+        while (lookup->slots[slot] && !(font->presets[lookup->slots[slot] - 1].bank == p->bank &&
+                                        font->presets[lookup->slots[slot] - 1].preset == p->preset))
+            slot = (slot + 1) & lookup->slot_mask;
+        if (!lookup->slots[slot])
+            lookup->slots[slot] = i + 1;
+    }
+
+    uint32_t entry = 0;
+    for (uint32_t i = 0; i < font->preset_count; i++)
+    {
+        const SynthPreset *p = &font->presets[i];
+        uint32_t *first = lookup->key_first + (size_t)i * 129;
+        for (int key = 0; key < 128; key++)
+        {
+            first[key] = entry;
+            for (uint32_t j = 0; j < p->region_count && p->region_index + j < font->region_count; j++)
+            {
+                const SynthRegion *r = &font->regions[p->region_index + j];
+                if (key >= r->lokey && key <= r->hikey)
+                    lookup->key_regions[entry++] = p->region_index + j;
+            }
+        }
+        first[128] = entry;
+    }
+
+    font->lookup = lookup;
+    return 1;
+}
+
+static void font_free_lookup(FontLookup *lookup)
+{
+    if (!lookup)
+        return;
+    free(lookup->slots);
+    free(lookup);
+}
+
+SynthFont *synth_font_load_sf2(const void *data, size_t size)
+{
+    Hydra h;
+    if (!parse_riff(data, size, &h))
+        return NULL;
+
+    uint32_t preset_count = h.phdr_n - 1;
+    SynthPreset *presets = calloc(preset_count, sizeof(SynthPreset));
+    RegionList regions = {NULL, 0, 0};
+    if (!presets)
+        return NULL;
+
+    for (uint32_t p = 0; p < preset_count; p++)
+    {
+        const uint8_t *rec = h.phdr + p * PHDR_SIZE;
+        SynthPreset *preset = &presets[p];
+        memcpy(preset->name, rec, 20);
+        preset->name[19] = '\0';
+        preset->preset = rd16(rec + 20);
+        preset->bank = rd16(rec + 22);
+        preset->region_index = regions.count;
+
+        uint32_t bag_from = rd16(rec + 24);
+        uint32_t bag_to = rd16(rec + PHDR_SIZE + 24);
+        if (bag_to > h.pbag_n)
+            bag_to = h.pbag_n;
+
+        int global[GEN_COUNT];
+        preset_defaults(global);
+
+        for (uint32_t bag = bag_from; bag < bag_to; bag++)
+        {
+            uint32_t from, to;
+            zone_gens(h.pbag, h.pbag_n, h.pgen_n, bag, &from, &to);
+
+            if (!zone_has_gen(h.pgen, from, to, GEN_INSTRUMENT))
+            {
+                if (bag == bag_from)
+                    apply_gens(global, h.pgen, from, to);
+                continue;
+            }
+
+            int pg[GEN_COUNT];
+            memcpy(pg, global, sizeof(pg));
+            apply_gens(pg, h.pgen, from, to);
+            if (!add_preset_zone(&regions, &h, pg))
+            {
+                free(presets);
+                free(regions.items);
+                return NULL;
+            }
+        }
+        preset->region_count = regions.count - preset->region_index;
+    }
+
+    // SF2 samples are little-endian int16, the renderer's own format: the
+    // pool is used where it lies and only copied if misaligned
+    int in_place = ((uintptr_t)h.smpl & 1) == 0;
+    SynthPreset *out_presets;
+    SynthRegion *out_regions;
+    int16_t *samples = NULL;
+    SynthFont *font = font_alloc(preset_count, regions.count, h.smpl_n, &out_presets, &out_regions,
+                                 in_place ? NULL : &samples);
+    if (font)
+    {
+        memcpy(out_presets, presets, preset_count * sizeof(SynthPreset));
+        if (regions.count)
+            memcpy(out_regions, regions.items, regions.count * sizeof(SynthRegion));
+        if (in_place)
+            font->samples = (const int16_t *)h.smpl;
+        else
+            memcpy(samples, h.smpl, (size_t)h.smpl_n * sizeof(int16_t));
+    }
+    free(presets);
+    free(regions.items);
+    if (font && !font_build_lookup(font))
+    {
+        synth_font_free(font);
+        return NULL;
+    }
+    return font;
+}
+
+// ---------------------------------------------------------------------------
+// Compressed sample pools
+//
+// Images can store the pool as independently decodable blocks of
+// SAMPLE_BLOCK samples: a predictor order and Rice parameter, the order's
+// warm-up samples raw, then the Rice-coded prediction residuals. The codec
+// is lossless. A font loaded from such an image decodes blocks into its own
+// pool the first time a region needs them, so only the instruments a track
+// plays are ever expanded.
+
+#define SAMPLE_BLOCK 4096
+// Quotients this large are written as an escape plus the raw value (an
+// order-2 residual of 16-bit samples needs 19 bits zigzagged)
+#define RICE_ESCAPE 24
+#define RICE_RAW_BITS 19
+
+typedef struct
+{
+    uint32_t start, end; // pool range, end exclusive
+    uint32_t base;       // start in a pruned pool
+} SampleSpan;
+
+static SampleSpan region_span(const SynthRegion *r, uint32_t sample_count)
+{
+    // Interpolation reads one sample past the end and past the loop end
+    SampleSpan span = {r->offset, r->end + 1, 0};
+    if (r->loop_mode != SYNTH_LOOP_NONE)
+    {
+        if (r->loop_start < span.start)
+            span.start = r->loop_start;
+        if (r->loop_end + 1 > span.end)
+            span.end = r->loop_end + 1;
+    }
+    if (span.end > sample_count)
+        span.end = sample_count;
+    return span;
+}
+
+typedef struct
+{
+    const uint8_t *data;     // compressed blocks
+    const uint32_t *offsets; // block_count + 1 byte offsets into data
+    uint32_t block_count;
+    uint8_t *ready;          // per block, set once decoded
+    pthread_mutex_t lock;
+} LazyPool;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size, cap;
+    uint64_t bits;
+    int bit_count;
+} BitWriter;
+
+static int bits_put(BitWriter *w, uint32_t value, int count)
+{
+    w->bits |= (uint64_t)value << w->bit_count;
+    w->bit_count += count;
+    while (w->bit_count >= 8)
+    {
+        if (w->size == w->cap)
+        {
+            size_t new_cap = w->cap ? w->cap * 2 : 65536;
+            uint8_t *grown = realloc(w->data, new_cap);
+            if (!grown)
+                return 0;
+            w->data = grown;
+            w->cap = new_cap;
+        }
+        w->data[w->size++] = (uint8_t)w->bits;
+        w->bits >>= 8;
+        w->bit_count -= 8;
+    }
+    return 1;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int rice_put(BitWriter *w, uint32_t value, int k)
+{
+    uint32_t q = value >> k;
+    if (q >= RICE_ESCAPE)
+        return bits_put(w, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE) && bits_put(w, value, RICE_RAW_BITS);
+    return bits_put(w, (1u << q) - 1, q + 1) && bits_put(w, value & ((1u << k) - 1), k);
+}
+
+// Fixed polynomial predictors of order 0 (silence), 1 (previous sample)
+// and 2 (linear extrapolation)
+static int32_t predict(const int16_t *s, uint32_t i, int order)
+{
+    return order == 0 ? 0 : order == 1 ? s[i - 1] : 2 * s[i - 1] - s[i - 2];
+}
+
+static int encode_block(BitWriter *w, const int16_t *samples, uint32_t count)
+{
+    // Pick the predictor and Rice parameter that code this block smallest
+    int best_order = 1, best_k = 0;
+    uint64_t best_bits = UINT64_MAX;
+    for (int order = 0; order <= 2; order++)
+    {
+        if ((uint32_t)order > count)
+            break;
+        for (int k = 0; k < 16; k++)
+        {
+            uint64_t bits = 16 * order;
+            for (uint32_t i = order; i < count && bits < best_bits; i++)
+            {
+                uint32_t q = zigzag(samples[i] - predict(samples, i, order)) >> k;
+                bits += q >= RICE_ESCAPE ? RICE_ESCAPE + RICE_RAW_BITS : q + 1 + k;
+            }
+            if (bits < best_bits)
+            {
+                best_bits = bits;
+                best_order = order;
+                best_k = k;
+            }
+        }
+    }
+
+    if (!bits_put(w, best_order, 4) || !bits_put(w, best_k, 4))
+        return 0;
+    for (int i = 0; i < best_order && (uint32_t)i < count; i++)
+        if (!bits_put(w, (uint16_t)samples[i], 16))
+            return 0;
+    for (uint32_t i = best_order; i < count; i++)
+        if (!rice_put(w, zigzag(samples[i] - predict(samples, i, best_order)), best_k))
+            return 0;
+    // Blocks start on a byte
+    return w->bit_count ? bits_put(w, 0, 8 - w->bit_count) : 1;
+}
+
+typedef struct
+{
+    const uint8_t *src, *end;
+    uint64_t bits;
+    int count;
+} BitReader;
+
+static uint32_t bits_take(BitReader *r, int n)
+{
+    while (r->count < n)
+    {
+        r->bits |= (uint64_t)(r->src < r->end ? *r->src++ : 0) << r->count;
+        r->count += 8;
+    }
+    uint32_t v = (uint32_t)(r->bits & ((1ull << n) - 1));
+    r->bits >>= n;
+    r->count -= n;
+    return v;
+}
+
+static void decode_block(const uint8_t *src, const uint8_t *src_end, int16_t *dst, uint32_t count)
+{
+    BitReader r = {src, src_end, 0, 0};
+    int order = (int)bits_take(&r, 4);
+    int k = (int)bits_take(&r, 4);
+    if (order > 2)
+        order = 2;
+
+    uint32_t i = 0;
+    for (; i < (uint32_t)order && i < count; i++)
+        dst[i] = (int16_t)bits_take(&r, 16);
+    for (; i < count; i++)
+    {
+        uint32_t q = 0;
+        while (q < RICE_ESCAPE && bits_take(&r, 1))
+            q++;
+        uint32_t value = q == RICE_ESCAPE ? bits_take(&r, RICE_RAW_BITS) : (q << k) | (k ? bits_take(&r, k) : 0);
+        int32_t residual = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        dst[i] = (int16_t)(predict(dst, i, order) + residual);
+    }
+}
+
+// Compresses the pool into [offsets][blocks]; *size receives the byte count
+static uint8_t *compress_pool(const int16_t *samples, uint32_t sample_count, uint32_t *size)
+{
+    uint32_t block_count = (sample_count + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    uint32_t *offsets = malloc((block_count + 1) * sizeof(uint32_t));
+    BitWriter w = {NULL, 0, 0, 0, 0};
+    if (!offsets)
+        return NULL;
+
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        uint32_t first = b * SAMPLE_BLOCK;
+        uint32_t count = sample_count - first < SAMPLE_BLOCK ? sample_count - first : SAMPLE_BLOCK;
+        offsets[b] = (uint32_t)w.size;
+        if (!encode_block(&w, samples + first, count))
+        {
+            free(offsets);
+            free(w.data);
+            return NULL;
+        }
+    }
+    offsets[block_count] = (uint32_t)w.size;
+
+    size_t table_size = (block_count + 1) * sizeof(uint32_t);
+    uint8_t *out = malloc(table_size + w.size);
+    if (out)
+    {
+        memcpy(out, offsets, table_size);
+        if (w.size)
+            memcpy(out + table_size, w.data, w.size);
+        *size = (uint32_t)(table_size + w.size);
+    }
+    free(offsets);
+    free(w.data);
+    return out;
+}
+
+static LazyPool *lazy_pool_create(const uint8_t *section, uint32_t section_size, uint32_t sample_count)
+{
+    uint32_t block_count = (sample_count + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    size_t table_size = (block_count + 1) * sizeof(uint32_t);
+    if (section_size < table_size)
+        return NULL;
+
+    const uint32_t *offsets = (const uint32_t *)section;
+    for (uint32_t b = 0; b < block_count; b++)
+        if (offsets[b] > offsets[b + 1])
+            return NULL;
+    if (offsets[block_count] > section_size - table_size)
+        return NULL;
+
+    LazyPool *lazy = malloc(sizeof(LazyPool));
+    uint8_t *ready = calloc(block_count + 1, 1);
+    if (!lazy || !ready)
+    {
+        free(lazy);
+        free(ready);
+        return NULL;
+    }
+    lazy->data = section + table_size;
+    lazy->offsets = offsets;
+    lazy->block_count = block_count;
+    lazy->ready = ready;
+    pthread_mutex_init(&lazy->lock, NULL);
+    return lazy;
+}
+
+static void lazy_pool_free(LazyPool *lazy)
+{
+    if (!lazy)
+        return;
+    pthread_mutex_destroy(&lazy->lock);
+    free(lazy->ready);
+    free(lazy);
+}
+
+// Makes samples [first, end) of a compressed font readable. Encoders on
+// other threads may ask for the same blocks; each is decoded once.
+static void font_require(const SynthFont *font, uint32_t first, uint32_t end)
+{
+    LazyPool *lazy = font->lazy;
+    if (!lazy || first >= end)
+        return;
+
+    int16_t *pool = (int16_t *)font->samples;
+    for (uint32_t b = first / SAMPLE_BLOCK; b <= (end - 1) / SAMPLE_BLOCK && b < lazy->block_count; b++)
+    {
+        if (__atomic_load_n(&lazy->ready[b], __ATOMIC_ACQUIRE))
+            continue;
+        pthread_mutex_lock(&lazy->lock);
+        if (!lazy->ready[b])
+        {
+            uint32_t start = b * SAMPLE_BLOCK;
+            uint32_t count = font->sample_count - start < SAMPLE_BLOCK ? font->sample_count - start : SAMPLE_BLOCK;
+            decode_block(lazy->data + lazy->offsets[b], lazy->data + lazy->offsets[b + 1], pool + start, count);
+            __atomic_store_n(&lazy->ready[b], 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&lazy->lock);
+    }
+}
+
+static void region_require(const SynthFont *font, const SynthRegion *r)
+{
+    SampleSpan span = region_span(r, font->sample_count);
+    font_require(font, span.start, span.end);
+}
+
+// ---------------------------------------------------------------------------
+// Font images
+
+#define IMAGE_ALIGN 64
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t region_size; // layout check: images are raw structs of the writer
+    uint32_t preset_count, region_count, sample_count;
+    uint32_t preset_offset, region_offset, sample_offset;
+    uint32_t total_size;
+    uint32_t flags;
+} ImageHeader;
+
+// The image holds presets and regions only; the pool lives elsewhere
+#define IMAGE_NO_SAMPLES 1
+// The pool is stored as compressed blocks
+#define IMAGE_COMPRESSED 2
+
+static uint32_t align_image(uint32_t offset)
+{
+    return (offset + IMAGE_ALIGN - 1) & ~(uint32_t)(IMAGE_ALIGN - 1);
+}
+
+static void write_padding(FILE *out, uint32_t *offset, uint32_t target)
+{
+    static const uint8_t zeros[IMAGE_ALIGN];
+    fwrite(zeros, 1, target - *offset, out);
+    *offset = target;
+}
+
+int synth_font_write_image(const SynthFont *font, FILE *out, int samples)
+{
+    uint8_t *compressed = NULL;
+    uint32_t compressed_size = 0;
+    font_require(font, 0, font->sample_count);
+    if (samples == SYNTH_IMAGE_COMPRESSED)
+    {
+        compressed = compress_pool(font->samples, font->sample_count, &compressed_size);
+        if (!compressed)
+            return 0;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SHSF", 4);
+    header.version = SYNTH_IMAGE_VERSION;
+    header.region_size = sizeof(SynthRegion);
+    header.preset_count = font->preset_count;
+    header.region_count = font->region_count;
+    header.sample_count = font->sample_count;
+    header.preset_offset = align_image(sizeof(ImageHeader));
+    header.region_offset = align_image(header.preset_offset + font->preset_count * sizeof(SynthPreset));
+    header.sample_offset = align_image(header.region_offset + font->region_count * sizeof(SynthRegion));
+    header.total_size = header.sample_offset;
+    if (samples == SYNTH_IMAGE_RAW)
+        header.total_size += font->sample_count * sizeof(int16_t);
+    else if (samples == SYNTH_IMAGE_COMPRESSED)
+        header.total_size += compressed_size;
+    header.flags = samples == SYNTH_IMAGE_TABLES ? IMAGE_NO_SAMPLES
+                   : samples == SYNTH_IMAGE_COMPRESSED ? IMAGE_COMPRESSED
+                                                       : 0;
+
+    uint32_t offset = sizeof(header);
+    fwrite(&header, sizeof(header), 1, out);
+    write_padding(out, &offset, header.preset_offset);
+    fwrite(font->presets, sizeof(SynthPreset), font->preset_count, out);
+    offset += font->preset_count * sizeof(SynthPreset);
+    write_padding(out, &offset, header.region_offset);
+    fwrite(font->regions, sizeof(SynthRegion), font->region_count, out);
+    offset += font->region_count * sizeof(SynthRegion);
+    write_padding(out, &offset, header.sample_offset);
+    if (samples == SYNTH_IMAGE_RAW)
+        fwrite(font->samples, sizeof(int16_t), font->sample_count, out);
+    else if (samples == SYNTH_IMAGE_COMPRESSED)
+        fwrite(compressed, 1, compressed_size, out);
+    free(compressed);
+    return !ferror(out);
+}
+
+// Whether every preset's regions and every region's sample range lie inside
+// the image's tables and pool, as the SF2 loader guarantees for its fonts
+static int image_tables_valid(const SynthPreset *presets, const SynthRegion *regions, const ImageHeader *h)
+{
+    for (uint32_t i = 0; i < h->preset_count; i++)
+        if ((uint64_t)presets[i].region_index + presets[i].region_count > h->region_count)
+            return 0;
+    for (uint32_t i = 0; i < h->region_count; i++)
+    {
+        const SynthRegion *r = &regions[i];
+        if (r->offset >= r->end || r->end > h->sample_count || r->loop_start > h->sample_count ||
+            r->loop_end > h->sample_count)
+            return 0;
+    }
+    return 1;
+}
+
+// Adopts image with samples as its pool when it was written without one.
+// Tables-only images need a pool of exactly their sample count, and images
+// with a pool of their own take none.
+static SynthFont *font_load_image(const void *image, size_t size, const int16_t *samples, uint32_t sample_count)
+{
+    const uint8_t *base = image;
+    ImageHeader header;
+    if (size < sizeof(header) || ((uintptr_t)image & (IMAGE_ALIGN - 1)))
+        return NULL;
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, "SHSF", 4) != 0 || header.version != SYNTH_IMAGE_VERSION ||
+        header.region_size != sizeof(SynthRegion) || header.total_size > size ||
+        header.preset_offset < sizeof(header) || header.sample_offset > header.total_size ||
+        ((header.preset_offset | header.region_offset) & (IMAGE_ALIGN - 1)) ||
+        header.preset_offset + (uint64_t)header.preset_count * sizeof(SynthPreset) > header.region_offset ||
+        header.region_offset + (uint64_t)header.region_count * sizeof(SynthRegion) > header.sample_offset ||
+        (!(header.flags & (IMAGE_NO_SAMPLES | IMAGE_COMPRESSED)) &&
+         header.sample_offset + (uint64_t)header.sample_count * sizeof(int16_t) > header.total_size))
+        return NULL;
+    int tables_only = (header.flags & IMAGE_NO_SAMPLES) != 0;
+    if (tables_only != (samples != NULL) || (samples && header.sample_count != sample_count))
+        return NULL;
+    if (!image_tables_valid((const SynthPreset *)(base + header.preset_offset),
+                            (const SynthRegion *)(base + header.region_offset), &header))
+        return NULL;
+
+    SynthFont *font = malloc(sizeof(SynthFont));
+    if (!font)
+        return NULL;
+    font->owned = NULL;
+    font->lazy = NULL;
+    font->lookup = NULL;
+    if (header.flags & IMAGE_COMPRESSED)
+    {
+        // Decoded blocks land in a zeroed pool whose pages are only
+        // committed once something is decoded into them
+        font->lazy = lazy_pool_create(base + header.sample_offset, header.total_size - header.sample_offset,
+                                      header.sample_count);
+        font->owned = calloc(header.sample_count ? header.sample_count : 1, sizeof(int16_t));
+        if (!font->lazy || !font->owned)
+        {
+            lazy_pool_free(font->lazy);
+            free(font->owned);
+            free(font);
+            return NULL;
+        }
+    }
+    font->presets = (const SynthPreset *)(base + header.preset_offset);
+    font->regions = (const SynthRegion *)(base + header.region_offset);
+    if (header.flags & IMAGE_COMPRESSED)
+        font->samples = font->owned;
+    else
+        font->samples = samples ? samples : (const int16_t *)(base + header.sample_offset);
+    font->preset_count = header.preset_count;
+    font->region_count = header.region_count;
+    font->sample_count = header.sample_count;
+    if (!font_build_lookup(font))
+    {
+        synth_font_free(font);
+        return NULL;
+    }
+    return font;
+}
+
+SynthFont *synth_font_load_image(const void *image, size_t size)
+{
+    return font_load_image(image, size, NULL, 0);
+}
+
+SynthFont *synth_font_load_tables(const void *image, size_t size, const int16_t *samples, uint32_t sample_count)
+{
+    return samples ? font_load_image(image, size, samples, sample_count) : NULL;
+}
+
+void synth_font_free(SynthFont *font)
+{
+    if (!font)
+        return;
+    font_free_lookup(font->lookup);
+    lazy_pool_free(font->lazy);
+    free(font->owned);
+    free(font);
+}
+
+int synth_font_find_preset(const SynthFont *font, int bank, int preset)
+{
+    const FontLookup *lookup = font->lookup;
+    if (lookup)
+    {
+        for (uint32_t slot = preset_hash(bank, preset) & lookup->slot_mask; lookup->slots[slot];
+             slot = (slot + 1) & lookup->slot_mask)
+        {
+            const SynthPreset *p = &font->presets[lookup->slots[slot] - 1];
+            if (p->preset == preset && p->bank == bank)
+                return (int)(lookup->slots[slot] - 1);
+        }
+        return -1;
+    }
+    for (uint32_t i = 0; i < font->preset_count; i++)
+        if (font->presets[i].preset == preset && font->presets[i].bank == bank)
+            return (int)i;
+    return -1;
+}
+
+const int16_t *synth_sf2_samples(const void *data, size_t size, uint32_t *count)
+{
+    Hydra h;
+    if (!parse_riff(data, size, &h) || ((uintptr_t)h.smpl & 1))
+        return NULL;
+    *count = h.smpl_n;
+    return (const int16_t *)h.smpl;
+}
+
+int synth_font_prefetch(const SynthFont *font, int bank, int preset, int key)
+{
+    int index = synth_font_find_preset(font, bank, preset);
+    if (index < 0)
+        return 0;
+
+    const SynthPreset *p = &font->presets[index];
+    uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    for (uint32_t i = 0; i < p->region_count; i++)
+    {
+        const SynthRegion *r = &font->regions[p->region_index + i];
+        if (key >= 0 && (key < r->lokey || key > r->hikey))
+            continue;
+        if (font->lazy)
+        {
+            // Compressed pools have nothing to read ahead; decoding is the fetch
+            region_require(font, r);
+            continue;
+        }
+
+        uint32_t first = r->offset, last = r->end;
+        if (r->loop_mode != SYNTH_LOOP_NONE)
+        {
+            first = r->loop_start < first ? r->loop_start : first;
+            last = r->loop_end > last ? r->loop_end : last;
+        }
+        if (last >= font->sample_count)
+            last = font->sample_count - 1;
+        uintptr_t start = (uintptr_t)(font->samples + first) & ~page_mask;
+        uintptr_t end = (uintptr_t)(font->samples + last + 1);
+        madvise((void *)start, end - start, MADV_WILLNEED);
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Pruning and repacking
+
+#define SPAN_UNPLACED UINT32_MAX
+
+static int span_compare(const void *a, const void *b)
+{
+    const SampleSpan *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int region_plays_keys(const SynthRegion *r, const SynthPresetFilter *filter)
+{
+    if (!filter->keys)
+        return 1;
+    for (int i = 0; i < filter->key_count; i++)
+        if (filter->keys[i] >= r->lokey && filter->keys[i] <= r->hikey)
+            return 1;
+    return 0;
+}
+
+// Merged span holding position, found by binary search on the start
+static const SampleSpan *find_span(const SampleSpan *spans, uint32_t count, uint32_t position)
+{
+    uint32_t lo = 0, hi = count;
+    while (hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (spans[mid].start <= position)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &spans[lo];
+}
+
+SynthFont *synth_font_prune(const SynthFont *font, const SynthPresetFilter *keep, int keep_count)
+{
+    font_require(font, 0, font->sample_count);
+    int *chosen = malloc(keep_count * sizeof(int));
+    SampleSpan *spans = malloc((font->region_count + 1) * sizeof(SampleSpan));
+    if (!chosen || !spans)
+    {
+        free(chosen);
+        free(spans);
+        return NULL;
+    }
+
+    // Resolve the filters to distinct presets and gather their sample spans
+    uint32_t preset_count = 0, region_count = 0, span_count = 0;
+    for (int f = 0; f < keep_count; f++)
+    {
+        int index = synth_font_find_preset(font, keep[f].bank, keep[f].preset);
+        chosen[f] = index;
+        for (int g = 0; g < f; g++)
+            if (chosen[g] == index)
+                chosen[f] = -1;
+        if (chosen[f] < 0)
+            continue;
+
+        const SynthPreset *p = &font->presets[index];
+        preset_count++;
+        for (uint32_t i = 0; i < p->region_count; i++)
+        {
+            const SynthRegion *r = &font->regions[p->region_index + i];
+            if (!region_plays_keys(r, &keep[f]))
+                continue;
+            spans[span_count++] = region_span(r, font->sample_count);
+            region_count++;
+        }
+    }
+
+    // Merge overlapping spans; regions often share one sample
+    qsort(spans, span_count, sizeof(SampleSpan), span_compare);
+    uint32_t merged = 0, sample_count = 0;
+    for (uint32_t i = 0; i < span_count; i++)
+    {
+        if (merged && spans[i].start <= spans[merged - 1].end)
+        {
+            if (spans[i].end > spans[merged - 1].end)
+                spans[merged - 1].end = spans[i].end;
+            continue;
+        }
+        spans[merged++] = spans[i];
+    }
+
+    // Lay spans out in the order the kept presets first play them, so the
+    // samples of one preset sit together instead of in file order
+    for (uint32_t i = 0; i < merged; i++)
+        spans[i].base = SPAN_UNPLACED;
+    for (int f = 0; f < keep_count; f++)
+    {
+        if (chosen[f] < 0)
+            continue;
+        const SynthPreset *p = &font->presets[chosen[f]];
+        for (uint32_t i = 0; i < p->region_count; i++)
+        {
+            const SynthRegion *r = &font->regions[p->region_index + i];
+            if (!region_plays_keys(r, &keep[f]))
+                continue;
+            SampleSpan *span = (SampleSpan *)find_span(spans, merged, region_span(r, font->sample_count).start);
+            if (span->base != SPAN_UNPLACED)
+                continue;
+            span->base = (sample_count + CACHE_LINE_SAMPLES - 1) & ~(uint32_t)(CACHE_LINE_SAMPLES - 1);
+            sample_count = span->base + (span->end - span->start);
+        }
+    }
+
+    SynthPreset *presets;
+    SynthRegion *regions;
+    int16_t *samples;
+    SynthFont *pruned = font_alloc(preset_count, region_count, sample_count, &presets, &regions, &samples);
+    if (!pruned)
+    {
+        free(chosen);
+        free(spans);
+        return NULL;
+    }
+
+    memset(samples, 0, (size_t)sample_count * sizeof(int16_t));
+    for (uint32_t i = 0; i < merged; i++)
+        memcpy(samples + spans[i].base, font->samples + spans[i].start,
+               (spans[i].end - spans[i].start) * sizeof(int16_t));
+
+    uint32_t out_preset = 0, out_region = 0;
+    for (int f = 0; f < keep_count; f++)
+    {
+        if (chosen[f] < 0)
+            continue;
+        const SynthPreset *p = &font->presets[chosen[f]];
+        SynthPreset *q = &presets[out_preset++];
+        *q = *p;
+        q->region_index = out_region;
+
+        for (uint32_t i = 0; i < p->region_count; i++)
+        {
+            const SynthRegion *r = &font->regions[p->region_index + i];
+            if (!region_plays_keys(r, &keep[f]))
+                continue;
+            SynthRegion *nr = &regions[out_region++];
+            const SampleSpan *span = find_span(spans, merged, region_span(r, font->sample_count).start);
+            uint32_t shift = span->start - span->base;
+            *nr = *r;
+            nr->offset -= shift;
+            nr->end -= shift;
+            if (r->loop_mode != SYNTH_LOOP_NONE)
+            {
+                nr->loop_start -= shift;
+                nr->loop_end -= shift;
+            }
+            else
+            {
+                nr->loop_start = 0;
+                nr->loop_end = 0;
+            }
+        }
+        q->region_count = out_region - q->region_index;
+    }
+
+    free(chosen);
+    free(spans);
+    if (!font_build_lookup(pruned))
+    {
+        synth_font_free(pruned);
+        return NULL;
+    }
+    return pruned;
+}
+
+// ---------------------------------------------------------------------------
+// Voices
+
+enum
+{
+    SEGMENT_NONE,
+    SEGMENT_DELAY,
+    SEGMENT_ATTACK,
+    SEGMENT_HOLD,
+    SEGMENT_DECAY,
+    SEGMENT_SUSTAIN,
+    SEGMENT_RELEASE,
+    SEGMENT_DONE
+};
+
+typedef struct
+{
+    float level, slope;
+    int samples_until_next;
+    int segment;
+    int exponential;
+    int is_amp;
+    int midi_velocity;
+    float delay, attack, hold, decay, sustain, release;
+} Envelope;
+
+typedef struct
+{
+    double q_inv, a0, a1, b1, b2, z1, z2;
+    int active;
+} Lowpass;
+
+typedef struct
+{
+    int samples_until;
+    float level, delta;
+} Lfo;
+
+typedef struct
+{
+    const SynthRegion *region;
+    int preset_index;
+    int channel, key;
+    unsigned play_index;
+    double position; // relative to the region's first sample
+    double pitch_input_timecents, pitch_output_factor;
+    float gain_db, pan_left, pan_right;
+    int32_t loop_start, loop_end; // relative like position, equal when not looping
+    Envelope ampenv, modenv;
+    Lowpass lowpass;
+    Lfo modlfo, viblfo;
+    // Where voice_steal() ranks the voice: 1 released, 0 held,
+    // and its index in synth->steal_heap
+    int steal_rank, heap_index;
+    int kernel; // VOICE_* bits picking the stock engine's render loop
+    int rate_shift; // renders at sample_rate >> rate_shift, from its channel
+} Voice;
+
+// Channels rendered below the output rate (synth_set_channel_rate) mix
+// their voices into an upsampler per rate, which brings them back to the
+// output rate through a polyphase lowpass
+#define UPSAMPLE_TAPS 16 // reduced-rate frames summed per output frame
+#define UPSAMPLE_SHIFTS 2 // rates down to sample_rate >> UPSAMPLE_SHIFTS
+
+typedef struct
+{
+    int divisor;
+    // Kaiser-windowed sinc cut off at the reduced rate's Nyquist frequency,
+    // one row of UPSAMPLE_TAPS per output phase, each summing to 1
+    float coeffs[(1 << UPSAMPLE_SHIFTS) * UPSAMPLE_TAPS];
+    // Stereo reduced-rate frames: the last UPSAMPLE_TAPS of earlier calls,
+    // then those of the current one
+    float input[(UPSAMPLE_TAPS + SYNTH_OUTPUT_BLOCK / 2) * 2];
+    int phase; // output frames rendered, modulo divisor
+} Upsampler;
+
+// What a voice's region uses, fixed at note-on. Each combination has its
+// own render loop with the other cases compiled out.
+enum
+{
+    VOICE_LOOPING = 1,
+    VOICE_FILTERED = 2,  // lowpass on, or cutoff modulated
+    VOICE_MODULATED = 4, // pitch, cutoff or volume follow an LFO or envelope
+};
+
+struct Synth
+{
+    const SynthFont *font;
+    float sample_rate;
+    // Fixed pool allocated with the synth. A set bit in live marks a
+    // playing voice; new voices take the lowest clear bit, so voices mix in
+    // slot order and the output does not depend on how the pool is scanned.
+    Voice *voices;
+    int voice_count;
+    uint64_t *live;
+    int live_words;
+    int live_count;
+    // Live slots as a binary heap with the next voice to steal at the root
+    int *steal_heap;
+    uint64_t stolen, culled, voice_frames;
+    uint64_t kernel_voices[SYNTH_VOICE_KERNELS];
+    // Voices whose output bound drops below this are retired early
+    float cull_level;
+    const SynthKernels *kernels;
+    // Bank engine state: lanes for every slot, rounded up to whole lane
+    // groups, and each voice's control values for the current render call
+    int engine;
+    SynthBank bank;
+    int bank_lanes;
+    void *bank_block;
+    struct VoiceControl *controls;
+    // Upsamplers by rate shift - 1, created when a channel first uses that
+    // rate, and each channel's shift for new voices
+    Upsampler *upsamplers[UPSAMPLE_SHIFTS];
+    int channel_rate_shift[SYNTH_CHANNELS];
+    unsigned play_index;
+    int channel_preset[SYNTH_CHANNELS];
+};
+
+static void envelope_next_segment(Envelope *e, int active_segment, float rate)
+{
+    switch (active_segment)
+    {
+    case SEGMENT_NONE:
+        e->samples_until_next = (int)(e->delay * rate);
+        if (e->samples_until_next > 0)
+        {
+            e->segment = SEGMENT_DELAY;
+            e->exponential = 0;
+            e->level = 0.0f;
+            e->slope = 0.0f;
+            return;
+        }
+        /* fall through */
+    case SEGMENT_DELAY:
+        e->samples_until_next = (int)(e->attack * rate);
+        if (e->samples_until_next > 0)
+        {
+            // Modulation envelope attacks are shortened by velocity
+            if (!e->is_amp)
+                e->samples_until_next = (int)(e->attack * ((145 - e->midi_velocity) / 144.0f) * rate);
+            if (e->samples_until_next < 1)
+                e->samples_until_next = 1;
+            e->segment = SEGMENT_ATTACK;
+            e->exponential = 0;
+            e->level = 0.0f;
+            e->slope = 1.0f / e->samples_until_next;
+            return;
+        }
+        /* fall through */
+    case SEGMENT_ATTACK:
+        e->samples_until_next = (int)(e->hold * rate);
+        if (e->samples_until_next > 0)
+        {
+            e->segment = SEGMENT_HOLD;
+            e->exponential = 0;
+            e->level = 1.0f;
+            e->slope = 0.0f;
+            return;
+        }
+        /* fall through */
+    case SEGMENT_HOLD:
+        e->samples_until_next = (int)(e->decay * rate);
+        if (e->samples_until_next > 0)
+        {
+            e->segment = SEGMENT_DECAY;
+            e->level = 1.0f;
+            if (e->is_amp)
+            {
+                // Exponential decay that would reach -80 dB after the decay
+                // time; it ends early where it crosses the sustain level
+                float slope = -9.226f / e->samples_until_next;
+                e->slope = expf(slope);
+                e->exponential = 1;
+                if (e->sustain > 0.0f)
+                    e->samples_until_next = (int)(logf(e->sustain) / slope);
+            }
+            else
+            {
+                e->slope = -1.0f / e->samples_until_next;
+                e->samples_until_next = (int)(e->decay * (1.0f - e->sustain) * rate);
+                e->exponential = 0;
+            }
+            return;
+        }
+        /* fall through */
+    case SEGMENT_DECAY:
+        e->segment = SEGMENT_SUSTAIN;
+        e->level = e->sustain;
+        e->slope = 0.0f;
+        e->samples_until_next = 0x7FFFFFFF;
+        e->exponential = 0;
+        return;
+    case SEGMENT_SUSTAIN:
+        e->segment = SEGMENT_RELEASE;
+        e->samples_until_next = (int)((e->release <= 0 ? SYNTH_FAST_RELEASE : e->release) * rate);
+        if (e->samples_until_next < 1)
+            e->samples_until_next = 1;
+        if (e->is_amp)
+        {
+            e->slope = expf(-9.226f / e->samples_until_next);
+            e->exponential = 1;
+        }
+        else
+        {
+            e->slope = -e->level / e->samples_until_next;
+            e->exponential = 0;
+        }
+        return;
+    case SEGMENT_RELEASE:
+    default:
+        e->segment = SEGMENT_DONE;
+        e->exponential = 0;
+        e->level = 0.0f;
+        e->slope = 0.0f;
+        e->samples_until_next = 0x7FFFFFFF;
+        return;
+    }
+}
+
+static void envelope_setup(Envelope *e, const SynthEnvelope *p, int key, int midi_velocity, int is_amp, float rate)
+{
+    e->delay = p->delay;
+    e->attack = p->attack;
+    e->hold = timecents_to_seconds(p->hold_tc + p->keynum_to_hold * (60 - key));
+    e->decay = timecents_to_seconds(p->decay_tc + p->keynum_to_decay * (60 - key));
+    e->sustain = p->sustain;
+    e->release = p->release;
+    e->midi_velocity = midi_velocity;
+    e->is_amp = is_amp;
+    envelope_next_segment(e, SEGMENT_NONE, rate);
+}
+
+static void envelope_process(Envelope *e, int samples, float rate)
+{
+    if (e->slope)
+    {
+        if (e->exponential)
+            e->level *= powf(e->slope, (float)samples);
+        else
+            e->level += e->slope * samples;
+    }
+    if ((e->samples_until_next -= samples) <= 0)
+        envelope_next_segment(e, e->segment, rate);
+}
+
+// Biquad lowpass (RBJ cookbook form)
+static void lowpass_setup(Lowpass *f, float fc)
+{
+    double k = tan(M_PI * fc), kk = k * k;
+    double norm = 1.0 / (1.0 + k * f->q_inv + kk);
+    f->a0 = kk * norm;
+    f->a1 = 2.0 * f->a0;
+    f->b1 = 2.0 * (kk - 1.0) * norm;
+    f->b2 = (1.0 - k * f->q_inv + kk) * norm;
+}
+
+static float lowpass_process(Lowpass *f, double in)
+{
+    double out = in * f->a0 + f->z1;
+    f->z1 = in * f->a1 + f->z2 - f->b1 * out;
+    f->z2 = in * f->a0 - f->b2 * out;
+    return (float)out;
+}
+
+static void lfo_setup(Lfo *l, float delay, int freq_cents, float rate)
+{
+    l->samples_until = (int)(delay * rate);
+    l->delta = 4.0f * cents_to_hertz((float)freq_cents) / rate;
+    l->level = 0.0f;
+}
+
+static void lfo_process(Lfo *l, int samples)
+{
+    if (l->samples_until > samples)
+    {
+        l->samples_until -= samples;
+        return;
+    }
+    l->level += l->delta * samples;
+    if (l->level > 1.0f)
+    {
+        l->delta = -l->delta;
+        l->level = 2.0f - l->level;
+    }
+    else if (l->level < -1.0f)
+    {
+        l->delta = -l->delta;
+        l->level = -2.0f - l->level;
+    }
+}
+
+// The rate v renders at: envelopes, LFOs, the filter and the pitch step
+// all count in its frames
+static inline float voice_rate(const Synth *synth, const Voice *v)
+{
+    return synth->sample_rate / (float)(1 << v->rate_shift);
+}
+
+// Whether a makes a better steal victim than b: the released before the
+// held, then the oldest note-on, then the lowest slot
+static int voice_steal_before(const Voice *a, const Voice *b)
+{
+    if (a->steal_rank != b->steal_rank)
+        return a->steal_rank > b->steal_rank;
+    if (a->play_index != b->play_index)
+        return a->play_index < b->play_index;
+    return a < b;
+}
+
+static void steal_heap_place(Synth *synth, int at, int slot)
+{
+    synth->steal_heap[at] = slot;
+    synth->voices[slot].heap_index = at;
+}
+
+// Moves the slot at heap index at to where its rank and age put it
+static void steal_heap_fix(Synth *synth, int at)
+{
+    int *heap = synth->steal_heap;
+    int slot = heap[at];
+    const Voice *v = &synth->voices[slot];
+    while (at > 0 && voice_steal_before(v, &synth->voices[heap[(at - 1) / 2]]))
+    {
+        steal_heap_place(synth, at, heap[(at - 1) / 2]);
+        at = (at - 1) / 2;
+    }
+    for (;;)
+    {
+        int child = 2 * at + 1;
+        if (child >= synth->live_count)
+            break;
+        if (child + 1 < synth->live_count &&
+            voice_steal_before(&synth->voices[heap[child + 1]], &synth->voices[heap[child]]))
+            child++;
+        if (!voice_steal_before(&synth->voices[heap[child]], v))
+            break;
+        steal_heap_place(synth, at, heap[child]);
+        at = child;
+    }
+    steal_heap_place(synth, at, slot);
+}
+
+// Re-ranks v after note-on or release
+static void voice_requeue(Synth *synth, Voice *v)
+{
+    v->steal_rank = v->ampenv.segment >= SEGMENT_RELEASE;
+    steal_heap_fix(synth, v->heap_index);
+}
+
+static void voice_end(Synth *synth, Voice *v)
+{
+    envelope_next_segment(&v->ampenv, SEGMENT_SUSTAIN, voice_rate(synth, v));
+    envelope_next_segment(&v->modenv, SEGMENT_SUSTAIN, voice_rate(synth, v));
+    // Sustain loops play out to the end of the sample once released
+    if (v->region->loop_mode == SYNTH_LOOP_SUSTAIN)
+        v->loop_end = v->loop_start;
+    voice_requeue(synth, v);
+}
+
+static void voice_end_quick(Synth *synth, Voice *v)
+{
+    v->ampenv.release = 0.0f;
+    v->modenv.release = 0.0f;
+    envelope_next_segment(&v->ampenv, SEGMENT_SUSTAIN, voice_rate(synth, v));
+    envelope_next_segment(&v->modenv, SEGMENT_SUSTAIN, voice_rate(synth, v));
+    voice_requeue(synth, v);
+}
+
+static void voice_setup(Synth *synth, Voice *v, const SynthRegion *r, int preset_index, int channel, int key,
+                        float velocity, int midi_velocity)
+{
+    // The bank engine renders every voice at the output rate
+    v->rate_shift = synth->engine == SYNTH_ENGINE_BANK ? 0 : synth->channel_rate_shift[channel];
+    float rate = voice_rate(synth, v);
+    v->region = r;
+    v->preset_index = preset_index;
+    v->channel = channel;
+    v->key = key;
+    v->play_index = synth->play_index;
+    v->gain_db = -r->attenuation + 20.0f * log10f(velocity);
+
+    double note = key + r->transpose + r->tune / 100.0;
+    double adjusted = r->pitch_keycenter + (note - r->pitch_keycenter) * (r->pitch_keytrack / 100.0);
+    v->pitch_input_timecents = adjusted * 100.0;
+    v->pitch_output_factor = r->sample_rate / (pow(2.0, r->pitch_keycenter / 12.0) * rate);
+
+    if (r->pan <= -0.5f)
+    {
+        v->pan_left = 1.0f;
+        v->pan_right = 0.0f;
+    }
+    else if (r->pan >= 0.5f)
+    {
+        v->pan_left = 0.0f;
+        v->pan_right = 1.0f;
+    }
+    else
+    {
+        v->pan_left = sqrtf(0.5f - r->pan);
+        v->pan_right = sqrtf(0.5f + r->pan);
+    }
+
+    int looping = r->loop_mode != SYNTH_LOOP_NONE && r->loop_start < r->loop_end;
+    v->loop_start = looping ? (int32_t)(r->loop_start - r->offset) : 0;
+    v->loop_end = looping ? (int32_t)(r->loop_end - r->offset) : 0;
+    v->position = 0.0;
+
+    v->lowpass.q_inv = 1.0 / decibels_to_gain(r->initial_filter_q / 10.0f);
+    v->lowpass.z1 = v->lowpass.z2 = 0.0;
+    float fc = r->initial_filter_fc <= 13500 ? cents_to_hertz((float)r->initial_filter_fc) / rate : 1.0f;
+    v->lowpass.active = fc < 0.499f;
+    if (v->lowpass.active)
+        lowpass_setup(&v->lowpass, fc);
+
+    envelope_setup(&v->ampenv, &r->ampenv, key, midi_velocity, 1, rate);
+    envelope_setup(&v->modenv, &r->modenv, key, midi_velocity, 0, rate);
+    lfo_setup(&v->modlfo, r->delay_mod_lfo, r->freq_mod_lfo, rate);
+    lfo_setup(&v->viblfo, r->delay_vib_lfo, r->freq_vib_lfo, rate);
+
+    int filter_modulated = r->mod_lfo_to_filter_fc || r->mod_env_to_filter_fc;
+    int modulated = filter_modulated || r->mod_lfo_to_pitch || r->mod_env_to_pitch || r->vib_lfo_to_pitch ||
+                    r->mod_lfo_to_volume;
+    v->kernel = (looping ? VOICE_LOOPING : 0) | (v->lowpass.active || filter_modulated ? VOICE_FILTERED : 0) |
+                (modulated ? VOICE_MODULATED : 0);
+    synth->kernel_voices[v->kernel]++;
+    voice_requeue(synth, v);
+}
+
+// Slot of the first live voice after slot after, or -1
+static int next_live_voice(const Synth *synth, int after)
+{
+    int i = after + 1, word = i >> 6;
+    if (word >= synth->live_words)
+        return -1;
+    uint64_t bits = synth->live[word] & (~0ULL << (i & 63));
+    while (!bits)
+    {
+        if (++word >= synth->live_words)
+            return -1;
+        bits = synth->live[word];
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+static int lowest_free_voice(const Synth *synth)
+{
+    for (int word = 0; word < synth->live_words; word++)
+    {
+        uint64_t free_bits = ~synth->live[word];
+        int tail = synth->voice_count - word * 64;
+        if (tail < 64)
+            free_bits &= (1ULL << tail) - 1;
+        if (free_bits)
+            return word * 64 + __builtin_ctzll(free_bits);
+    }
+    return -1;
+}
+
+// With every slot playing, the oldest released voice makes room, or else
+// the oldest voice; ties go to the lowest slot.
+// The heap keeps that order, so the victim is its root.
+static int voice_steal(Synth *synth)
+{
+    return synth->live_count > 0 ? synth->steal_heap[0] : -1;
+}
+
+static Voice *voice_alloc(Synth *synth)
+{
+    int i = lowest_free_voice(synth);
+    if (i < 0)
+    {
+        i = voice_steal(synth);
+        if (i < 0)
+            return NULL;
+        synth->stolen++;
+        return &synth->voices[i];
+    }
+    synth->live[i >> 6] |= 1ULL << (i & 63);
+    // Queued last until voice_setup() ranks it
+    steal_heap_place(synth, synth->live_count++, i);
+    return &synth->voices[i];
+}
+
+static void voice_free(Synth *synth, int i)
+{
+    synth->live[i >> 6] &= ~(1ULL << (i & 63));
+    int at = synth->voices[i].heap_index;
+    if (--synth->live_count > at)
+    {
+        steal_heap_place(synth, at, synth->steal_heap[synth->live_count]);
+        steal_heap_fix(synth, at);
+    }
+}
+
+// Values derived from a voice's region once per render call
+typedef struct VoiceControl
+{
+    int update_modenv, update_modlfo, update_viblfo;
+    int dynamic_lowpass, dynamic_pitch, dynamic_gain;
+    double pitch_ratio;
+    float note_gain;
+    // Bound on what the voice can add to one output sample per unit of
+    // envelope level, 0 when not culling
+    float peak_gain;
+} VoiceControl;
+
+static void voice_control_begin(const Synth *synth, const Voice *v, VoiceControl *c)
+{
+    const SynthRegion *r = v->region;
+    c->update_modenv = r->mod_env_to_pitch || r->mod_env_to_filter_fc;
+    c->update_modlfo = v->modlfo.delta && (r->mod_lfo_to_pitch || r->mod_lfo_to_filter_fc || r->mod_lfo_to_volume);
+    c->update_viblfo = v->viblfo.delta && r->vib_lfo_to_pitch;
+    c->dynamic_lowpass = r->mod_lfo_to_filter_fc || r->mod_env_to_filter_fc;
+    c->dynamic_pitch = r->mod_lfo_to_pitch || r->mod_env_to_pitch || r->vib_lfo_to_pitch;
+    c->dynamic_gain = r->mod_lfo_to_volume != 0;
+    c->pitch_ratio = c->dynamic_pitch ? 0.0 : pow(2.0, v->pitch_input_timecents / 1200.0) * v->pitch_output_factor;
+    c->note_gain = c->dynamic_gain ? 0.0f : decibels_to_gain(v->gain_db);
+
+    // The loudest the volume LFO can make the voice, times the louder pan
+    // side, times a generous allowance for filter resonance (1/q_inv is the
+    // filter's Q) and the -32768 sample
+    c->peak_gain = 0.0f;
+    if (synth->cull_level > 0.0f)
+    {
+        float lfo_db = c->dynamic_gain ? fabsf(r->mod_lfo_to_volume * 0.1f) : 0.0f;
+        float pan = v->pan_left > v->pan_right ? v->pan_left : v->pan_right;
+        c->peak_gain = decibels_to_gain(v->gain_db + lfo_db) * pan * (float)(2.0 / v->lowpass.q_inv) * (32768.0f / 32767.0f);
+    }
+}
+
+// Control-rate work at the start of an effect block: updates the filter
+// coefficients in lowpass, sets the block's pitch ratio and gains and
+// advances the envelopes and LFOs past the block. Returns 0 if the voice
+// is culled instead, and it is freed like a finished one. Without modulated, none of c's dynamic flags may be set.
+static inline __attribute__((always_inline)) int voice_control_block_with(Synth *synth, Voice *v, VoiceControl *c,
+                                                                         Lowpass *lowpass, int block,
+                                                                         float *gain_left, float *gain_right,
+                                                                         int modulated)
+{
+    const SynthRegion *r = v->region;
+    float rate = voice_rate(synth, v);
+    if (modulated && c->dynamic_lowpass)
+    {
+        float fres = r->initial_filter_fc + v->modlfo.level * r->mod_lfo_to_filter_fc +
+                     v->modenv.level * r->mod_env_to_filter_fc;
+        float fc = fres <= 13500 ? cents_to_hertz(fres) / rate : 1.0f;
+        lowpass->active = fc < 0.499f;
+        if (lowpass->active)
+            lowpass_setup(lowpass, fc);
+    }
+    if (modulated && c->dynamic_pitch)
+        c->pitch_ratio = pow(2.0, (v->pitch_input_timecents + v->modlfo.level * r->mod_lfo_to_pitch +
+                                   v->viblfo.level * r->vib_lfo_to_pitch + v->modenv.level * r->mod_env_to_pitch) /
+                                      1200.0) *
+                         v->pitch_output_factor;
+    if (modulated && c->dynamic_gain)
+        c->note_gain = decibels_to_gain(v->gain_db + v->modlfo.level * r->mod_lfo_to_volume * 0.1f);
+
+    // Past the attack the envelope only falls, so once the bound is below
+    // the cull level the voice stays inaudible for good
+    if (c->peak_gain > 0.0f && v->ampenv.segment >= SEGMENT_DECAY &&
+        c->peak_gain * v->ampenv.level < synth->cull_level)
+    {
+        synth->culled++;
+        return 0;
+    }
+    synth->voice_frames += block;
+
+    float gain = c->note_gain * v->ampenv.level;
+    *gain_left = gain * v->pan_left;
+    *gain_right = gain * v->pan_right;
+
+    envelope_process(&v->ampenv, block, rate);
+    if (modulated && c->update_modenv)
+        envelope_process(&v->modenv, block, rate);
+    if (modulated && c->update_modlfo)
+        lfo_process(&v->modlfo, block);
+    if (modulated && c->update_viblfo)
+        lfo_process(&v->viblfo, block);
+    return 1;
+}
+
+static int voice_control_block(Synth *synth, Voice *v, VoiceControl *c, Lowpass *lowpass, int block,
+                               float *gain_left, float *gain_right)
+{
+    return voice_control_block_with(synth, v, c, lowpass, block, gain_left, gain_right, 1);
+}
+
+// Interpolates n samples from position on, stepping by repeated addition
+// like the single steps, and returns the position after them
+static inline __attribute__((always_inline)) double interpolate_run(const int16_t *input, double position,
+                                                                   double step, int n, float *out)
+{
+    for (int k = 0; k < n; k++)
+    {
+        int32_t pos = (int32_t)position;
+        float alpha = (float)(position - pos);
+        out[k] = (input[pos] * (1.0f - alpha) + input[pos + 1] * alpha) * (1.0f / 32767.0f);
+        position += step;
+    }
+    return position;
+}
+
+// Renders one voice through frames (the stock engine). Returns 0 once the
+// voice has finished. looping, filtered and modulated are the VOICE_* bits
+// of v->kernel; every caller passes constants, so each instance keeps only
+// the code its voices need.
+static inline __attribute__((always_inline)) int voice_render_with(Synth *synth, Voice *v, float *out, int frames,
+                                                                  int looping, int filtered, int modulated)
+{
+    const SynthRegion *r = v->region;
+    // Positions count from the region start, so the result does not depend
+    // on where the sample sits in the pool
+    const int16_t *input = synth->font->samples + r->offset;
+
+    int32_t loop_start = v->loop_start, loop_end = v->loop_end;
+    double end = (double)(r->end - r->offset), loop_end_d = (double)loop_end, loop_length = (double)(loop_end - loop_start);
+    double position = v->position;
+    Lowpass lowpass = v->lowpass;
+    VoiceControl control;
+    voice_control_begin(synth, v, &control);
+
+    while (frames > 0)
+    {
+        int block = frames > SYNTH_EFFECT_BLOCK ? SYNTH_EFFECT_BLOCK : frames;
+        frames -= block;
+
+        float gain_left, gain_right;
+        if (!voice_control_block_with(synth, v, &control, &lowpass, block, &gain_left, &gain_right, modulated))
+            return 0;
+        double pitch_ratio = control.pitch_ratio;
+
+        // Interpolate the block's samples, filter them, then mix them in.
+        // Runs that cannot reach the loop end (where the next sample wraps)
+        // or the sample end go through the kernels, or a loop without any
+        // checks; only the steps near those ends are taken one by one.
+        float val[SYNTH_EFFECT_BLOCK];
+        int count = 0;
+        double run_limit = looping && loop_end_d - 1 < end ? loop_end_d - 1 : end;
+        while (count < block && position < end)
+        {
+            int run = 0;
+            if (position < run_limit && pitch_ratio > 1e-6)
+            {
+                double steps = (run_limit - position) / pitch_ratio;
+                run = steps < block - count ? (int)steps : block - count;
+            }
+            if (run > 0)
+            {
+                if (synth->kernels->interpolate)
+                {
+                    synth->kernels->interpolate(input, position, pitch_ratio, run, val + count);
+                    position += run * pitch_ratio;
+                }
+                else
+                    position = interpolate_run(input, position, pitch_ratio, run, val + count);
+                count += run;
+            }
+            else
+            {
+                int32_t pos = (int32_t)position;
+                int32_t next = (looping && pos + 1 >= loop_end) ? loop_start : pos + 1;
+                float alpha = (float)(position - pos);
+                // Interpolate the raw 16-bit values and scale once to -1..1
+                val[count++] = (input[pos] * (1.0f - alpha) + input[next] * alpha) * (1.0f / 32767.0f);
+                position += pitch_ratio;
+            }
+            if (looping && position >= loop_end_d)
+                position -= loop_length;
+        }
+        if (filtered && lowpass.active)
+            for (int i = 0; i < count; i++)
+                val[i] = lowpass_process(&lowpass, val[i]);
+        synth->kernels->mix(out, val, count, gain_left, gain_right);
+        out += 2 * count;
+
+        if (position >= end || v->ampenv.segment == SEGMENT_DONE)
+            return 0;
+    }
+
+    v->position = position;
+    if (filtered)
+        v->lowpass = lowpass;
+    return 1;
+}
+
+#define VOICE_RENDERER(kernel)                                                                                   \
+    static int voice_render_##kernel(Synth *synth, Voice *v, float *out, int frames)                           \
+    {                                                                                                          \
+        return voice_render_with(synth, v, out, frames, (kernel) & VOICE_LOOPING, (kernel) & VOICE_FILTERED,  \
+                                 (kernel) & VOICE_MODULATED);                                                  \
+    }
+VOICE_RENDERER(0)
+VOICE_RENDERER(1)
+VOICE_RENDERER(2)
+VOICE_RENDERER(3)
+VOICE_RENDERER(4)
+VOICE_RENDERER(5)
+VOICE_RENDERER(6)
+VOICE_RENDERER(7)
+
+static int (*const voice_renderers[SYNTH_VOICE_KERNELS])(Synth *, Voice *, float *, int) = {
+    voice_render_0, voice_render_1, voice_render_2, voice_render_3,
+    voice_render_4, voice_render_5, voice_render_6, voice_render_7};
+
+static const char *const voice_kernel_names[SYNTH_VOICE_KERNELS] = {
+    "oneshot", "loop", "oneshot+filter", "loop+filter",
+    "oneshot+mod", "loop+mod", "oneshot+filter+mod", "loop+filter+mod"};
+
+const char *synth_voice_kernel_name(int kernel)
+{
+    return kernel >= 0 && kernel < SYNTH_VOICE_KERNELS ? voice_kernel_names[kernel] : "unknown";
+}
+
+// The bank engine keeps the audio-rate state of every voice slot in
+// SynthBank arrays and renders SYNTH_BANK_LANES voices at a time, one
+// output frame per step, so the SIMD lanes run across voices. Envelopes,
+// LFOs and filter coefficients are still worked out per voice, once per
+// effect block, by the same code as the stock engine.
+static void bank_voice_start(Synth *synth, int slot)
+{
+    synth->bank.position[slot] = 0.0;
+    synth->bank.z1[slot] = synth->bank.z2[slot] = 0.0;
+}
+
+// Copies a voice's block parameters into its lanes
+static void bank_load_lane(Synth *synth, int slot, const Voice *v, double pitch_ratio, float gain_left,
+                           float gain_right)
+{
+    SynthBank *b = &synth->bank;
+    const SynthRegion *r = v->region;
+    int looping = v->loop_start < v->loop_end;
+    b->step[slot] = pitch_ratio;
+    b->end[slot] = (double)(r->end - r->offset);
+    b->offset[slot] = (int32_t)r->offset;
+    b->wrap_at[slot] = looping ? v->loop_end : INT32_MAX;
+    b->loop_start[slot] = v->loop_start;
+    b->loop_end[slot] = looping ? (double)v->loop_end : INFINITY;
+    b->loop_length[slot] = (double)(v->loop_end - v->loop_start);
+    b->filtered[slot] = v->lowpass.active;
+    b->a0[slot] = v->lowpass.a0;
+    b->a1[slot] = v->lowpass.a1;
+    b->b1[slot] = v->lowpass.b1;
+    b->b2[slot] = v->lowpass.b2;
+    b->gain_left[slot] = gain_left;
+    b->gain_right[slot] = gain_right;
+    b->active[slot] = 1;
+}
+
+static void bank_render(Synth *synth, float *mix, int frames)
+{
+    SynthBank *b = &synth->bank;
+    for (int done = 0; done < frames; done += SYNTH_EFFECT_BLOCK)
+    {
+        int block = frames - done > SYNTH_EFFECT_BLOCK ? SYNTH_EFFECT_BLOCK : frames - done;
+        memset(b->active, 0, synth->bank_lanes * sizeof(int32_t));
+        for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+        {
+            Voice *v = &synth->voices[i];
+            float gain_left, gain_right;
+            if (done == 0)
+                voice_control_begin(synth, v, &synth->controls[i]);
+            if (!voice_control_block(synth, v, &synth->controls[i], &v->lowpass, block, &gain_left, &gain_right))
+            {
+                voice_free(synth, i);
+                continue;
+            }
+            bank_load_lane(synth, i, v, synth->controls[i].pitch_ratio, gain_left, gain_right);
+        }
+
+        for (int first = 0; first < synth->bank_lanes; first += SYNTH_BANK_LANES)
+        {
+            int any = 0;
+            for (int l = first; l < first + SYNTH_BANK_LANES; l++)
+                any |= b->active[l];
+            if (any)
+                synth->kernels->bank_render(b, first, synth->font->samples, block, mix + 2 * done);
+        }
+
+        for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+            if (b->active[i] && (b->position[i] >= b->end[i] || synth->voices[i].ampenv.segment == SEGMENT_DONE))
+                voice_free(synth, i);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Multi-rate channels
+
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Splits a lowpass of divisor * UPSAMPLE_TAPS taps, cut off at the reduced
+// rate's Nyquist frequency, into its polyphase rows. Each row is scaled to
+// sum to 1 so that every output phase has unit gain at DC.
+static void upsampler_setup(Upsampler *u, int divisor)
+{
+    const double beta = 7.0; // Kaiser window, about 70 dB stopband
+    int length = divisor * UPSAMPLE_TAPS;
+    double center = (length - 1) / 2.0;
+    memset(u, 0, sizeof(*u));
+    u->divisor = divisor;
+    for (int phase = 0; phase < divisor; phase++)
+    {
+        double taps[UPSAMPLE_TAPS], sum = 0.0;
+        for (int t = 0; t < UPSAMPLE_TAPS; t++)
+        {
+            // Output frame phase reads the reduced frame t back
+            double k = t * divisor + phase - center, x = k / divisor;
+            double sinc = sin(M_PI * x) / (M_PI * x);
+            double window = bessel_i0(beta * sqrt(1.0 - (k / center) * (k / center))) / bessel_i0(beta);
+            taps[t] = sinc * window;
+            sum += taps[t];
+        }
+        for (int t = 0; t < UPSAMPLE_TAPS; t++)
+            u->coeffs[phase * UPSAMPLE_TAPS + t] = (float)(taps[t] / sum);
+    }
+}
+
+// Clears the input frames for a call of frames output frames and returns
+// how many reduced-rate frames start in it, which the voices then render
+// from u->input + UPSAMPLE_TAPS * 2
+static int upsampler_begin(Upsampler *u, int frames)
+{
+    int first = (u->divisor - u->phase) % u->divisor;
+    int count = first < frames ? (frames - first + u->divisor - 1) / u->divisor : 0;
+    memset(u->input + UPSAMPLE_TAPS * 2, 0, count * 2 * sizeof(float));
+    return count;
+}
+
+// Adds the call's frames output frames, interpolated from count reduced
+// frames and the history before them, to out, then keeps the last
+// UPSAMPLE_TAPS reduced frames for the next call. Output frames of one
+// phase read consecutive reduced frames, so each phase is summed tap by
+// tap over all its frames, a loop the compiler vectorizes. The output lags
+// the reduced-rate voices by (divisor * UPSAMPLE_TAPS - 1) / 2 frames.
+static void upsampler_mix(Upsampler *u, float *out, int frames, int count)
+{
+    float sum[SYNTH_OUTPUT_BLOCK];
+    int divisor = u->divisor;
+    for (int phase = 0; phase < divisor; phase++)
+    {
+        // First output frame of this phase, and the newest reduced frame
+        // it reads; output frame first + k * divisor reads newest + k
+        int first = (phase - u->phase + divisor) % divisor;
+        if (first >= frames)
+            continue;
+        int outputs = (frames - 1 - first) / divisor + 1;
+        int newest = (u->phase + first) / divisor - (u->phase > 0) + UPSAMPLE_TAPS;
+        memset(sum, 0, outputs * 2 * sizeof(float));
+        for (int t = 0; t < UPSAMPLE_TAPS; t++)
+        {
+            float coeff = u->coeffs[phase * UPSAMPLE_TAPS + t];
+            const float *in = u->input + (newest - t) * 2;
+            for (int j = 0; j < outputs * 2; j++)
+                sum[j] += coeff * in[j];
+        }
+        for (int k = 0; k < outputs; k++)
+        {
+            out[(first + k * divisor) * 2] += sum[2 * k];
+            out[(first + k * divisor) * 2 + 1] += sum[2 * k + 1];
+        }
+    }
+    u->phase = (u->phase + frames) % divisor;
+    memmove(u->input, u->input + count * 2, UPSAMPLE_TAPS * 2 * sizeof(float));
+}
+
+int synth_set_channel_rate(Synth *synth, int channel, int divisor)
+{
+    int shift = 0;
+    while (shift <= UPSAMPLE_SHIFTS && (1 << shift) != divisor)
+        shift++;
+    if (channel < 0 || channel >= SYNTH_CHANNELS || shift > UPSAMPLE_SHIFTS)
+        return 0;
+    if (shift && !synth->upsamplers[shift - 1])
+    {
+        Upsampler *u = malloc(sizeof(Upsampler));
+        if (!u)
+            return 0;
+        upsampler_setup(u, divisor);
+        synth->upsamplers[shift - 1] = u;
+    }
+    synth->channel_rate_shift[channel] = shift;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Synth
+
+// Kernels that new synths render with. The best the CPU supports are
+// picked once, before any synth reads them, however many threads create
+// synths at the same time.
+static const SynthKernels *default_kernels;
+static pthread_once_t default_kernels_once = PTHREAD_ONCE_INIT;
+
+// The highest level up to level that the CPU supports
+static int kernels_supported_level(int level)
+{
+    if (level > SYNTH_KERNELS_BEST)
+        level = SYNTH_KERNELS_BEST;
+    for (; level > SYNTH_KERNELS_SCALAR; level--)
+        if (synth_kernels_get(level))
+            break;
+    return level;
+}
+
+static void default_kernels_pick(void)
+{
+    default_kernels = synth_kernels_get(kernels_supported_level(SYNTH_KERNELS_BEST));
+}
+
+int synth_use_kernels(int level)
+{
+    pthread_once(&default_kernels_once, default_kernels_pick);
+    level = kernels_supported_level(level);
+    default_kernels = synth_kernels_get(level);
+    return level;
+}
+
+const char *synth_kernels_name(int level)
+{
+    const SynthKernels *kernels = synth_kernels_get(level);
+    return kernels ? kernels->name : "unsupported";
+}
+
+Synth *synth_create(const SynthFont *font, float sample_rate, int max_voices)
+{
+    if (max_voices <= 0)
+        max_voices = SYNTH_DEFAULT_VOICES;
+    Synth *synth = calloc(1, sizeof(Synth));
+    if (!synth)
+        return NULL;
+    synth->font = font;
+    synth->sample_rate = sample_rate;
+    pthread_once(&default_kernels_once, default_kernels_pick);
+    synth->kernels = default_kernels;
+    synth->voice_count = max_voices;
+    synth->live_words = (max_voices + 63) / 64;
+    synth->voices = calloc(max_voices, sizeof(Voice));
+    synth->live = calloc(synth->live_words, sizeof(uint64_t));
+    synth->steal_heap = malloc(max_voices * sizeof(int));
+    if (!synth->voices || !synth->live || !synth->steal_heap)
+    {
+        synth_destroy(synth);
+        return NULL;
+    }
+    return synth;
+}
+
+int synth_set_engine(Synth *synth, int engine)
+{
+    if (engine == synth->engine)
+        return 1;
+    if (engine != SYNTH_ENGINE_BANK)
+    {
+        for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+        {
+            synth->voices[i].position = synth->bank.position[i];
+            synth->voices[i].lowpass.z1 = synth->bank.z1[i];
+            synth->voices[i].lowpass.z2 = synth->bank.z2[i];
+        }
+        synth->engine = SYNTH_ENGINE_VOICES;
+        return 1;
+    }
+    if (!synth->bank_block)
+    {
+        // Eleven double arrays, then five int32 and two float arrays
+        int lanes = (synth->voice_count + SYNTH_BANK_LANES - 1) / SYNTH_BANK_LANES * SYNTH_BANK_LANES;
+        size_t doubles = (size_t)lanes * sizeof(double), words = (size_t)lanes * sizeof(int32_t);
+        uint8_t *block = aligned_alloc(64, 11 * doubles + 7 * words);
+        VoiceControl *controls = malloc(synth->voice_count * sizeof(VoiceControl));
+        if (!block || !controls)
+        {
+            free(block);
+            free(controls);
+            return 0;
+        }
+        memset(block, 0, 11 * doubles + 7 * words);
+        double **double_fields[] = {&synth->bank.position, &synth->bank.step, &synth->bank.end,
+                                    &synth->bank.loop_end, &synth->bank.loop_length, &synth->bank.a0,
+                                    &synth->bank.a1, &synth->bank.b1, &synth->bank.b2,
+                                    &synth->bank.z1, &synth->bank.z2};
+        for (int f = 0; f < 11; f++)
+            *double_fields[f] = (double *)(block + f * doubles);
+        uint8_t *words_base = block + 11 * doubles;
+        synth->bank.offset = (int32_t *)words_base;
+        synth->bank.wrap_at = (int32_t *)(words_base + words);
+        synth->bank.loop_start = (int32_t *)(words_base + 2 * words);
+        synth->bank.active = (int32_t *)(words_base + 3 * words);
+        synth->bank.filtered = (int32_t *)(words_base + 4 * words);
+        synth->bank.gain_left = (float *)(words_base + 5 * words);
+        synth->bank.gain_right = (float *)(words_base + 6 * words);
+        synth->bank_block = block;
+        synth->bank_lanes = lanes;
+        synth->controls = controls;
+    }
+    // Voices already playing carry their state over, except reduced-rate
+    // ones, as the bank renders at the output rate
+    for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+    {
+        if (synth->voices[i].rate_shift)
+        {
+            voice_free(synth, i);
+            continue;
+        }
+        synth->bank.position[i] = synth->voices[i].position;
+        synth->bank.z1[i] = synth->voices[i].lowpass.z1;
+        synth->bank.z2[i] = synth->voices[i].lowpass.z2;
+    }
+    synth->engine = SYNTH_ENGINE_BANK;
+    return 1;
+}
+
+void synth_destroy(Synth *synth)
+{
+    if (!synth)
+        return;
+    free(synth->bank_block);
+    free(synth->controls);
+    for (int s = 0; s < UPSAMPLE_SHIFTS; s++)
+        free(synth->upsamplers[s]);
+    free(synth->voices);
+    free(synth->live);
+    free(synth->steal_heap);
+    free(synth);
+}
+
+void synth_reset(Synth *synth)
+{
+    memset(synth->live, 0, synth->live_words * sizeof(uint64_t));
+    synth->live_count = 0;
+    for (int c = 0; c < SYNTH_CHANNELS; c++)
+        synth->channel_preset[c] = 0;
+    for (int s = 0; s < UPSAMPLE_SHIFTS; s++)
+        if (synth->upsamplers[s])
+        {
+            memset(synth->upsamplers[s]->input, 0, sizeof(synth->upsamplers[s]->input));
+            synth->upsamplers[s]->phase = 0;
+        }
+    synth->play_index = 0;
+}
+
+void synth_channel_set_preset(Synth *synth, int channel, int bank, int preset)
+{
+    if (channel < 0 || channel >= SYNTH_CHANNELS)
+        return;
+    int index = synth_font_find_preset(synth->font, bank, preset);
+    if (index >= 0)
+        synth->channel_preset[channel] = index;
+}
+
+void synth_channel_note_on(Synth *synth, int channel, int key, float velocity)
+{
+    if (channel < 0 || channel >= SYNTH_CHANNELS)
+        return;
+    if (velocity <= 0.0f)
+    {
+        synth_channel_note_off(synth, channel, key);
+        return;
+    }
+
+    int preset_index = synth->channel_preset[channel];
+    if ((uint32_t)preset_index >= synth->font->preset_count)
+        return;
+    int midi_velocity = (int)(velocity * 127.0f);
+
+    synth->play_index++;
+    if (key < 0 || key > 127)
+        return;
+    // A key struck again releases the notes still held on it, so a note
+    // without its own note-off (drums, repeated melody notes) cannot pile up
+    for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+    {
+        Voice *v = &synth->voices[i];
+        if (v->channel == channel && v->key == key && v->ampenv.segment < SEGMENT_RELEASE)
+            voice_end(synth, v);
+    }
+    // Only the regions listed for this key are tried; velocity layers are
+    // few enough per key to check directly
+    const FontLookup *lookup = synth->font->lookup;
+    const uint32_t *first = lookup->key_first + (size_t)preset_index * 129 + key;
+    for (uint32_t e = first[0]; e < first[1]; e++)
+    {
+        const SynthRegion *r = &synth->font->regions[lookup->key_regions[e]];
+        if (midi_velocity < r->lovel || midi_velocity > r->hivel)
+            continue;
+
+        // Exclusive classes (e.g. open/closed hi-hat) cut each other off
+        if (r->group)
+        {
+            for (int j = next_live_voice(synth, -1); j >= 0; j = next_live_voice(synth, j))
+            {
+                Voice *other = &synth->voices[j];
+                if (other->preset_index == preset_index && other->channel == channel &&
+                    other->region->group == r->group)
+                    voice_end_quick(synth, other);
+            }
+        }
+
+        Voice *v = voice_alloc(synth);
+        if (!v)
+            return;
+        region_require(synth->font, r);
+        voice_setup(synth, v, r, preset_index, channel, key, velocity, midi_velocity);
+        if (synth->engine == SYNTH_ENGINE_BANK)
+            bank_voice_start(synth, (int)(v - synth->voices));
+    }
+}
+
+void synth_channel_note_off(Synth *synth, int channel, int key)
+{
+    // Releases the oldest still-held note-on of this key, with all its regions
+    unsigned oldest = 0;
+    int found = 0;
+    for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+    {
+        Voice *v = &synth->voices[i];
+        if (v->channel != channel || v->key != key || v->ampenv.segment >= SEGMENT_RELEASE)
+            continue;
+        if (!found || v->play_index < oldest)
+            oldest = v->play_index;
+        found = 1;
+    }
+    if (!found)
+        return;
+
+    for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+    {
+        Voice *v = &synth->voices[i];
+        if (v->channel == channel && v->key == key && v->play_index == oldest &&
+            v->ampenv.segment < SEGMENT_RELEASE)
+            voice_end(synth, v);
+    }
+}
+
+void synth_render_short(Synth *synth, int16_t *buffer, size_t frames)
+{
+    float mix[SYNTH_OUTPUT_BLOCK * 2];
+    while (frames > 0)
+    {
+        int n = frames > SYNTH_OUTPUT_BLOCK ? SYNTH_OUTPUT_BLOCK : (int)frames;
+        memset(mix, 0, n * 2 * sizeof(float));
+        int reduced[UPSAMPLE_SHIFTS] = {0};
+        for (int s = 0; s < UPSAMPLE_SHIFTS; s++)
+            if (synth->upsamplers[s])
+                reduced[s] = upsampler_begin(synth->upsamplers[s], n);
+        if (synth->engine == SYNTH_ENGINE_BANK)
+            bank_render(synth, mix, n);
+        else
+            for (int i = next_live_voice(synth, -1); i >= 0; i = next_live_voice(synth, i))
+            {
+                Voice *v = &synth->voices[i];
+                // Reduced-rate voices render the frames of their rate that
+                // start in this call into its upsampler
+                float *out = mix;
+                int frames_here = n;
+                if (v->rate_shift)
+                {
+                    out = synth->upsamplers[v->rate_shift - 1]->input + UPSAMPLE_TAPS * 2;
+                    frames_here = reduced[v->rate_shift - 1];
+                    if (!frames_here)
+                        continue;
+                }
+                if (!voice_renderers[v->kernel](synth, v, out, frames_here))
+                    voice_free(synth, i);
+            }
+        for (int s = 0; s < UPSAMPLE_SHIFTS; s++)
+            if (synth->upsamplers[s])
+                upsampler_mix(synth->upsamplers[s], mix, n, reduced[s]);
+
+        synth->kernels->to_short(buffer, mix, n * 2);
+        buffer += n * 2;
+        frames -= n;
+    }
+}
+
+int synth_active_voices(const Synth *synth)
+{
+    return synth->live_count;
+}
+
+void synth_set_cull_level(Synth *synth, float level)
+{
+    synth->cull_level = level;
+}
+
+void synth_voice_stats(const Synth *synth, SynthVoiceStats *stats)
+{
+    stats->voice_frames = synth->voice_frames;
+    stats->stolen = synth->stolen;
+    stats->culled = synth->culled;
+    memcpy(stats->kernel_voices, synth->kernel_voices, sizeof(stats->kernel_voices));
+}
@@ -0,0 +1,207 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// SoundFont 2 synthesizer modeled on TinySoundFont: a parsed font that is
+// immutable and shareable, and per-renderer voice state on top of it.
+
+// Envelope times are in seconds except hold and decay, which stay in
+// timecents because the key number scales them at note-on.
+typedef struct
+{
+    float delay, attack, hold_tc, decay_tc, release;
+    float sustain; // level, 0..1
+    float keynum_to_hold, keynum_to_decay;
+} SynthEnvelope;
+
+// One playable zone: a sample range with all SF2 generators resolved.
+// Plain data without pointers so fonts can be serialized as-is.
+typedef struct
+{
+    uint32_t offset, end;           // sample pool indices, end exclusive
+    uint32_t loop_start, loop_end;  // loop_end exclusive
+    uint32_t sample_rate;
+    uint8_t lokey, hikey, lovel, hivel;
+    uint8_t loop_mode;
+    uint8_t pitch_keycenter;
+    int16_t transpose;              // semitones
+    int16_t tune;                   // cents
+    int16_t pitch_keytrack;         // cents per key
+    uint16_t group;                 // exclusive class
+    float attenuation;              // dB
+    float pan;                      // -0.5 (left) .. 0.5 (right)
+    SynthEnvelope ampenv, modenv;
+    int32_t initial_filter_q, initial_filter_fc;
+    int32_t mod_env_to_pitch, mod_env_to_filter_fc;
+    int32_t mod_lfo_to_pitch, mod_lfo_to_filter_fc, mod_lfo_to_volume;
+    int32_t vib_lfo_to_pitch;
+    float delay_mod_lfo, delay_vib_lfo;
+    int32_t freq_mod_lfo, freq_vib_lfo;
+} SynthRegion;
+
+enum
+{
+    SYNTH_LOOP_NONE = 0,
+    SYNTH_LOOP_CONTINUOUS = 1,
+    SYNTH_LOOP_SUSTAIN = 3
+};
+
+typedef struct
+{
+    char name[20];
+    uint16_t preset, bank;
+    uint32_t region_index, region_count;
+} SynthPreset;
+
+typedef struct
+{
+    const SynthPreset *presets;
+    const SynthRegion *regions;
+    const int16_t *samples; // raw SF2 sample data, scaled to -1..1 while rendering
+    uint32_t preset_count, region_count, sample_count;
+    void *owned;  // heap block holding whatever is not borrowed from an image or SF2 data
+    void *lazy;   // block decoder when the pool comes from a compressed image
+    void *lookup; // preset and per-key region tables for note-on, built at load
+} SynthFont;
+
+// Frames between envelope, LFO and filter updates
+#define SYNTH_EFFECT_BLOCK 64
+
+// Parses an SF2 file held in memory. The sample pool is used in place, so
+// data must stay alive (and unmodified) as long as the font.
+SynthFont *synth_font_load_sf2(const void *data, size_t size);
+// Sample pool of an SF2 file in memory, found without parsing any presets
+// (NULL if the file is invalid or the pool is misaligned)
+const int16_t *synth_sf2_samples(const void *data, size_t size, uint32_t *count);
+
+// Images are raw font structures, valid only for builds with the same
+// SYNTH_IMAGE_VERSION and struct layout
+#define SYNTH_IMAGE_VERSION 4
+// Sample pool storage in an image
+enum
+{
+    SYNTH_IMAGE_TABLES = 0,    // presets and regions only
+    SYNTH_IMAGE_RAW = 1,       // int16 pool, used in place
+    SYNTH_IMAGE_COMPRESSED = 2 // losslessly compressed blocks, decoded on first use
+};
+// Adopts a font image written by synth_font_write_image(). The font points
+// into image, which must stay alive and be 64-byte aligned; only compressed
+// pools are expanded, block by block as regions start playing. Images
+// written without samples (SYNTH_IMAGE_TABLES) are rejected.
+SynthFont *synth_font_load_image(const void *image, size_t size);
+// Adopts a SYNTH_IMAGE_TABLES image with samples, which must stay alive, as
+// its pool. Returns NULL for other images or a pool of a different size.
+SynthFont *synth_font_load_tables(const void *image, size_t size, const int16_t *samples, uint32_t sample_count);
+int synth_font_write_image(const SynthFont *font, FILE *out, int samples);
+void synth_font_free(SynthFont *font);
+// Index into font->presets, or -1
+int synth_font_find_preset(const SynthFont *font, int bank, int preset);
+
+// Asks the OS to read ahead the sample pages a preset plays for key (-1 for
+// every key). Purely advisory: samples are otherwise paged in on first use.
+// Returns 0 if the font has no such preset.
+int synth_font_prefetch(const SynthFont *font, int bank, int preset, int key);
+
+// A preset to keep when pruning; keys limits it to the regions that can
+// sound for those notes (NULL keeps every region)
+typedef struct
+{
+    int bank, preset;
+    const uint8_t *keys;
+    int key_count;
+} SynthPresetFilter;
+
+// Copy of font holding only the filtered presets, with the sample pool
+// compacted to the ranges their regions play and repacked so each preset's
+// samples are contiguous and start on cache lines. Missing presets are
+// skipped.
+SynthFont *synth_font_prune(const SynthFont *font, const SynthPresetFilter *keep, int keep_count);
+
+typedef struct Synth Synth;
+
+// Voice pool size when synth_create() is given 0
+#define SYNTH_DEFAULT_VOICES 256
+
+// The voice pool is allocated here and never grows: once max_voices are
+// playing, each new voice replaces the oldest released one, or else the
+// oldest one. Live voices are kept in a heap in
+// that order, so picking the victim is O(1) and note-on, release and
+// freeing a voice cost O(log max_voices).
+Synth *synth_create(const SynthFont *font, float sample_rate, int max_voices);
+void synth_destroy(Synth *synth);
+// Silences every voice and restores the default channel state
+void synth_reset(Synth *synth);
+// Selects bank/preset on a channel; unknown presets keep the current one
+void synth_channel_set_preset(Synth *synth, int channel, int bank, int preset);
+// Releases the voices still held on channel/key first, so a key struck
+// again is not left sounding twice
+void synth_channel_note_on(Synth *synth, int channel, int key, float velocity);
+void synth_channel_note_off(Synth *synth, int channel, int key);
+// Renders interleaved stereo 16-bit frames (buffer is overwritten)
+void synth_render_short(Synth *synth, int16_t *buffer, size_t frames);
+int synth_active_voices(const Synth *synth);
+// Instruction set levels of the renderer's inner loops. The SIMD levels
+// may differ from the scalar one by 1 LSB in occasional samples.
+enum
+{
+    SYNTH_KERNELS_SCALAR,
+    SYNTH_KERNELS_SSE2,
+    SYNTH_KERNELS_AVX2,
+    SYNTH_KERNELS_AVX512,
+    SYNTH_KERNELS_BEST = SYNTH_KERNELS_AVX512
+};
+// Makes synths created from now on use level, or the highest level below
+// it that the CPU supports, and returns the level chosen. Without a call
+// synths use the best level. Not safe while other threads create synths.
+int synth_use_kernels(int level);
+const char *synth_kernels_name(int level);
+
+// Render engines. The stock engine renders one voice at a time; the bank
+// engine keeps voice state as structure-of-arrays and renders groups of
+// voices side by side in SIMD lanes. Their output differs only in the order
+// voices are summed (within 1 LSB).
+enum
+{
+    SYNTH_ENGINE_VOICES,
+    SYNTH_ENGINE_BANK
+};
+// Switches engine; playing voices carry over. Returns 0 if the bank's
+// arrays cannot be allocated.
+int synth_set_engine(Synth *synth, int engine);
+
+// Renders the voices channel starts from now on at the synth's rate divided
+// by divisor (1, 2 or 4) and upsamples them into the mix through a
+// polyphase lowpass cut off at the reduced rate's Nyquist frequency. Their
+// voice frames shrink by the divisor; they lose what lies above that
+// frequency and lag the other channels by divisor * 8 frames (0.4 ms at
+// 44.1 kHz and a divisor of 2). Kept across synth_reset; the bank engine
+// renders every channel at full rate. Returns 0 for other divisors or if
+// the upsampler cannot be allocated.
+int synth_set_channel_rate(Synth *synth, int channel, int divisor);
+
+// Voices stop early once their envelope is past the attack and the most
+// they can add to an output sample is below level (output spans -1..1);
+// 0, the default, renders every voice to its end
+void synth_set_cull_level(Synth *synth, float level);
+
+// The stock engine renders each voice with a loop specialised for its
+// region at note-on: looping or one-shot, with or without the lowpass, and
+// with or without modulation of pitch, cutoff or volume. Kernel numbers
+// index SynthVoiceStats.kernel_voices.
+#define SYNTH_VOICE_KERNELS 8
+const char *synth_voice_kernel_name(int kernel);
+
+// Counters since the synth was created
+typedef struct
+{
+    uint64_t voice_frames; // frames rendered, summed over voices
+    uint64_t stolen;       // voices replaced at the polyphony cap
+    uint64_t culled;       // voices retired below the cull level
+    uint64_t kernel_voices[SYNTH_VOICE_KERNELS]; // voices started per kernel
+} SynthVoiceStats;
+void synth_voice_stats(const Synth *synth, SynthVoiceStats *stats);
+
+#endif
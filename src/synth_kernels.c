@@ -0,0 +1,465 @@
+#include "synth_kernels.h"
+#include "synth.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+// Every set is compiled into the same binary, each function for its own
+// target, and picked at run time from what the CPU reports. The SIMD sets
+// compute sample positions as position + k * step instead of adding step
+// once per sample, so they can land on a neighbouring float now and then;
+// the difference in the 16-bit output stays within 1 LSB.
+
+// ---------------------------------------------------------------------------
+// Scalar
+
+static void mix_scalar(float *out, const float *val, int n, float gain_left, float gain_right)
+{
+    for (int i = 0; i < n; i++)
+    {
+        *out++ += val[i] * gain_left;
+        *out++ += val[i] * gain_right;
+    }
+}
+
+static int16_t sample_to_short(float v)
+{
+    return v < -1.00004566f ? -32768 : v > 1.00001514f ? 32767 : (int16_t)(v * 32767.5f);
+}
+
+static void to_short_scalar(int16_t *out, const float *in, int n)
+{
+    for (int i = 0; i < n; i++)
+        out[i] = sample_to_short(in[i]);
+}
+
+// One bank lane for one frame, the stock voice loop's arithmetic
+static float bank_lane_step(SynthBank *b, int l, const int16_t *samples)
+{
+    double position = b->position[l];
+    int32_t pos = (int32_t)position;
+    int32_t next = pos + 1 >= b->wrap_at[l] ? b->loop_start[l] : pos + 1;
+    float alpha = (float)(position - pos);
+    const int16_t *input = samples + b->offset[l];
+    float val = (input[pos] * (1.0f - alpha) + input[next] * alpha) * (1.0f / 32767.0f);
+    if (b->filtered[l])
+    {
+        double in = val, out = in * b->a0[l] + b->z1[l];
+        b->z1[l] = in * b->a1[l] + b->z2[l] - b->b1[l] * out;
+        b->z2[l] = in * b->a0[l] - b->b2[l] * out;
+        val = (float)out;
+    }
+    position += b->step[l];
+    if (position >= b->loop_end[l])
+        position -= b->loop_length[l];
+    b->position[l] = position;
+    return val;
+}
+
+static void bank_render_scalar(SynthBank *b, int first, const int16_t *samples, int frames, float *out)
+{
+    for (int t = 0; t < frames; t++)
+    {
+        float left = 0.0f, right = 0.0f;
+        for (int l = first; l < first + SYNTH_BANK_LANES; l++)
+        {
+            if (!b->active[l] || b->position[l] >= b->end[l])
+                continue;
+            float val = bank_lane_step(b, l, samples);
+            left += val * b->gain_left[l];
+            right += val * b->gain_right[l];
+        }
+        out[2 * t] += left;
+        out[2 * t + 1] += right;
+    }
+}
+
+static const SynthKernels kernels_scalar = {"scalar", NULL, mix_scalar, to_short_scalar, bank_render_scalar};
+
+#ifdef KERNELS_X86
+
+// Remainder of a vector run, with the same position formula as the vectors
+static void interpolate_tail(const int16_t *input, double position, double step, int k, int n, float *out)
+{
+    for (; k < n; k++)
+    {
+        double p = position + k * step;
+        int32_t pos = (int32_t)p;
+        float alpha = (float)(p - pos);
+        out[k] = (input[pos] * (1.0f - alpha) + input[pos + 1] * alpha) * (1.0f / 32767.0f);
+    }
+}
+
+// Sign-extends the two int16 samples packed in each 32-bit lane
+#define SPLIT_PAIRS(pairs, lo, hi, prefix)                                   \
+    do                                                                       \
+    {                                                                        \
+        lo = prefix##_srai_epi32(prefix##_slli_epi32(pairs, 16), 16);        \
+        hi = prefix##_srai_epi32(pairs, 16);                                 \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+// SSE2
+
+__attribute__((target("sse2"))) static void interpolate_sse2(const int16_t *input, double position, double step,
+                                                            int n, float *out)
+{
+    const __m128d steps01 = _mm_set_pd(step, 0.0), steps23 = _mm_set_pd(3.0 * step, 2.0 * step);
+    const __m128 one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(1.0f / 32767.0f);
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128d base = _mm_set1_pd(position + k * step);
+        __m128d p01 = _mm_add_pd(base, steps01), p23 = _mm_add_pd(base, steps23);
+        __m128i i01 = _mm_cvttpd_epi32(p01), i23 = _mm_cvttpd_epi32(p23);
+        __m128 a01 = _mm_cvtpd_ps(_mm_sub_pd(p01, _mm_cvtepi32_pd(i01)));
+        __m128 a23 = _mm_cvtpd_ps(_mm_sub_pd(p23, _mm_cvtepi32_pd(i23)));
+        __m128 alpha = _mm_movelh_ps(a01, a23);
+
+        int32_t idx[4], words[4];
+        _mm_storel_epi64((__m128i *)idx, i01);
+        _mm_storel_epi64((__m128i *)(idx + 2), i23);
+        for (int j = 0; j < 4; j++)
+            memcpy(&words[j], input + idx[j], sizeof(int32_t));
+        __m128i pairs = _mm_loadu_si128((const __m128i *)words), lo, hi;
+        SPLIT_PAIRS(pairs, lo, hi, _mm);
+
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_sub_ps(one, alpha)),
+                              _mm_mul_ps(_mm_cvtepi32_ps(hi), alpha));
+        _mm_storeu_ps(out + k, _mm_mul_ps(v, scale));
+    }
+    interpolate_tail(input, position, step, k, n, out);
+}
+
+__attribute__((target("sse2"))) static void mix_sse2(float *out, const float *val, int n, float gain_left,
+                                                    float gain_right)
+{
+    const __m128 gain = _mm_setr_ps(gain_left, gain_right, gain_left, gain_right);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(val + i);
+        __m128 lo = _mm_unpacklo_ps(v, v), hi = _mm_unpackhi_ps(v, v);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(_mm_loadu_ps(out + 2 * i), _mm_mul_ps(lo, gain)));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(out + 2 * i + 4), _mm_mul_ps(hi, gain)));
+    }
+    mix_scalar(out + 2 * i, val + i, n - i, gain_left, gain_right);
+}
+
+// Clamping before the truncating conversion and letting the pack saturate
+// gives exactly the scalar rounding and limits
+__attribute__((target("sse2"))) static void to_short_sse2(int16_t *out, const float *in, int n)
+{
+    const __m128 scale = _mm_set1_ps(32767.5f), low = _mm_set1_ps(-40000.0f), high = _mm_set1_ps(40000.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), low), high);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), low), high);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b)));
+    }
+    to_short_scalar(out + i, in + i, n - i);
+}
+
+// Without gathers the bank gains little from SSE2; it keeps the scalar lanes
+static const SynthKernels kernels_sse2 = {"sse2", interpolate_sse2, mix_sse2, to_short_sse2, bank_render_scalar};
+
+// ---------------------------------------------------------------------------
+// AVX2
+
+__attribute__((target("avx2"))) static void interpolate_avx2(const int16_t *input, double position, double step,
+                                                            int n, float *out)
+{
+    const __m256d steps = _mm256_set_pd(3.0 * step, 2.0 * step, step, 0.0);
+    const __m128 one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(1.0f / 32767.0f);
+    int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256d p = _mm256_add_pd(_mm256_set1_pd(position + k * step), steps);
+        __m128i idx = _mm256_cvttpd_epi32(p);
+        __m128 alpha = _mm256_cvtpd_ps(_mm256_sub_pd(p, _mm256_cvtepi32_pd(idx)));
+        // One 32-bit gather fetches each sample together with its successor
+        __m128i pairs = _mm_i32gather_epi32((const int *)input, idx, 2), lo, hi;
+        SPLIT_PAIRS(pairs, lo, hi, _mm);
+
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_sub_ps(one, alpha)),
+                              _mm_mul_ps(_mm_cvtepi32_ps(hi), alpha));
+        _mm_storeu_ps(out + k, _mm_mul_ps(v, scale));
+    }
+    interpolate_tail(input, position, step, k, n, out);
+}
+
+__attribute__((target("avx2"))) static void mix_avx2(float *out, const float *val, int n, float gain_left,
+                                                    float gain_right)
+{
+    const __m256 gain = _mm256_setr_ps(gain_left, gain_right, gain_left, gain_right, gain_left, gain_right,
+                                       gain_left, gain_right);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_loadu_ps(val + i);
+        __m256 lo = _mm256_unpacklo_ps(v, v), hi = _mm256_unpackhi_ps(v, v);
+        __m256 first = _mm256_permute2f128_ps(lo, hi, 0x20), second = _mm256_permute2f128_ps(lo, hi, 0x31);
+        _mm256_storeu_ps(out + 2 * i, _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), _mm256_mul_ps(first, gain)));
+        _mm256_storeu_ps(out + 2 * i + 8,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * i + 8), _mm256_mul_ps(second, gain)));
+    }
+    mix_scalar(out + 2 * i, val + i, n - i, gain_left, gain_right);
+}
+
+__attribute__((target("avx2"))) static void to_short_avx2(int16_t *out, const float *in, int n)
+{
+    const __m256 scale = _mm256_set1_ps(32767.5f), low = _mm256_set1_ps(-40000.0f), high = _mm256_set1_ps(40000.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), low), high);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), low), high);
+        // The pack works per 128-bit lane; restore the sample order after it
+        __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    to_short_scalar(out + i, in + i, n - i);
+}
+
+// Four lanes (one register of doubles) for all frames; the group is done
+// as two such halves summed into out
+__attribute__((target("avx2"))) static void bank_half_avx2(SynthBank *b, int first, const int16_t *samples,
+                                                          int frames, float *out)
+{
+    const __m128 one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(1.0f / 32767.0f);
+    const __m128i lane_one = _mm_set1_epi32(1), pick_low = _mm_setr_epi32(0, 2, 4, 6);
+    __m256d position = _mm256_loadu_pd(b->position + first), step = _mm256_loadu_pd(b->step + first);
+    __m256d end = _mm256_loadu_pd(b->end + first), loop_end = _mm256_loadu_pd(b->loop_end + first);
+    __m256d loop_length = _mm256_loadu_pd(b->loop_length + first);
+    __m256d a0 = _mm256_loadu_pd(b->a0 + first), a1 = _mm256_loadu_pd(b->a1 + first);
+    __m256d b1 = _mm256_loadu_pd(b->b1 + first), b2 = _mm256_loadu_pd(b->b2 + first);
+    __m256d z1 = _mm256_loadu_pd(b->z1 + first), z2 = _mm256_loadu_pd(b->z2 + first);
+    __m128i offset = _mm_loadu_si128((const __m128i *)(b->offset + first));
+    __m128i wrap_at = _mm_loadu_si128((const __m128i *)(b->wrap_at + first));
+    __m128i loop_start = _mm_loadu_si128((const __m128i *)(b->loop_start + first));
+    __m128i live = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(b->active + first)), _mm_setzero_si128());
+    __m128i filtered = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(b->filtered + first)), _mm_setzero_si128());
+    __m128 gain_left = _mm_loadu_ps(b->gain_left + first), gain_right = _mm_loadu_ps(b->gain_right + first);
+
+    for (int t = 0; t < frames; t++)
+    {
+        // 64-bit compare masks narrowed to the 32-bit lanes
+        __m256i below_end = _mm256_castpd_si256(_mm256_cmp_pd(position, end, _CMP_LT_OQ));
+        __m128i act = _mm_and_si128(live, _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                                              below_end, _mm256_castsi128_si256(pick_low))));
+        if (_mm_movemask_epi8(act) == 0)
+            break;
+
+        __m128i pos = _mm256_cvttpd_epi32(position), next = _mm_add_epi32(pos, lane_one);
+        __m128i wrap = _mm_and_si128(act, _mm_cmpgt_epi32(next, _mm_sub_epi32(wrap_at, lane_one)));
+        __m128 alpha = _mm256_cvtpd_ps(_mm256_sub_pd(position, _mm256_cvtepi32_pd(pos)));
+        __m128i pairs = _mm_mask_i32gather_epi32(_mm_setzero_si128(), (const int *)samples,
+                                                 _mm_add_epi32(offset, pos), act, 2);
+        __m128i lo = _mm_srai_epi32(_mm_slli_epi32(pairs, 16), 16), hi = _mm_srai_epi32(pairs, 16);
+        if (_mm_movemask_epi8(wrap))
+        {
+            __m128i wrapped = _mm_mask_i32gather_epi32(_mm_setzero_si128(), (const int *)samples,
+                                                       _mm_add_epi32(offset, loop_start), wrap, 2);
+            hi = _mm_blendv_epi8(hi, _mm_srai_epi32(_mm_slli_epi32(wrapped, 16), 16), wrap);
+        }
+        __m128 val = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_sub_ps(one, alpha)),
+                                           _mm_mul_ps(_mm_cvtepi32_ps(hi), alpha)),
+                                scale);
+
+        __m128i run_filter = _mm_and_si128(act, filtered);
+        if (_mm_movemask_epi8(run_filter))
+        {
+            __m256d in = _mm256_cvtps_pd(val);
+            __m256d filtered_out = _mm256_add_pd(_mm256_mul_pd(in, a0), z1);
+            __m256d mask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(run_filter));
+            z1 = _mm256_blendv_pd(z1, _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(in, a1), z2), _mm256_mul_pd(b1, filtered_out)),
+                                  mask);
+            z2 = _mm256_blendv_pd(z2, _mm256_sub_pd(_mm256_mul_pd(in, a0), _mm256_mul_pd(b2, filtered_out)), mask);
+            val = _mm_blendv_ps(val, _mm256_cvtpd_ps(filtered_out), _mm_castsi128_ps(run_filter));
+        }
+        val = _mm_and_ps(val, _mm_castsi128_ps(act));
+
+        __m128 sums = _mm_hadd_ps(_mm_mul_ps(val, gain_left), _mm_mul_ps(val, gain_right));
+        sums = _mm_hadd_ps(sums, sums);
+        _mm_storel_pi((__m64 *)(out + 2 * t), _mm_add_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(out + 2 * t)), sums));
+
+        __m256d act64 = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(act));
+        position = _mm256_add_pd(position, _mm256_and_pd(step, act64));
+        __m256d over = _mm256_and_pd(act64, _mm256_cmp_pd(position, loop_end, _CMP_GE_OQ));
+        position = _mm256_sub_pd(position, _mm256_and_pd(loop_length, over));
+    }
+
+    _mm256_storeu_pd(b->position + first, position);
+    _mm256_storeu_pd(b->z1 + first, z1);
+    _mm256_storeu_pd(b->z2 + first, z2);
+}
+
+__attribute__((target("avx2"))) static void bank_render_avx2(SynthBank *b, int first, const int16_t *samples,
+                                                            int frames, float *out)
+{
+    for (int half = first; half < first + SYNTH_BANK_LANES; half += 4)
+    {
+        int any = 0;
+        for (int l = half; l < half + 4; l++)
+            any |= b->active[l];
+        if (any)
+            bank_half_avx2(b, half, samples, frames, out);
+    }
+}
+
+static const SynthKernels kernels_avx2 = {"avx2", interpolate_avx2, mix_avx2, to_short_avx2, bank_render_avx2};
+
+// ---------------------------------------------------------------------------
+// AVX-512
+
+__attribute__((target("avx512f,avx2"))) static void interpolate_avx512(const int16_t *input, double position,
+                                                                      double step, int n, float *out)
+{
+    const __m512d steps = _mm512_mul_pd(_mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0), _mm512_set1_pd(step));
+    const __m256 one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(1.0f / 32767.0f);
+    int k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m512d p = _mm512_add_pd(_mm512_set1_pd(position + k * step), steps);
+        __m256i idx = _mm512_cvttpd_epi32(p);
+        __m256 alpha = _mm512_cvtpd_ps(_mm512_sub_pd(p, _mm512_cvtepi32_pd(idx)));
+        __m256i pairs = _mm256_i32gather_epi32((const int *)input, idx, 2), lo, hi;
+        SPLIT_PAIRS(pairs, lo, hi, _mm256);
+
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), _mm256_sub_ps(one, alpha)),
+                                 _mm256_mul_ps(_mm256_cvtepi32_ps(hi), alpha));
+        _mm256_storeu_ps(out + k, _mm256_mul_ps(v, scale));
+    }
+    interpolate_tail(input, position, step, k, n, out);
+}
+
+__attribute__((target("avx512f"))) static void mix_avx512(float *out, const float *val, int n, float gain_left,
+                                                         float gain_right)
+{
+    const __m512i first_index = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i second_index = _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15);
+    const __m512 gain = _mm512_setr_ps(gain_left, gain_right, gain_left, gain_right, gain_left, gain_right,
+                                       gain_left, gain_right, gain_left, gain_right, gain_left, gain_right,
+                                       gain_left, gain_right, gain_left, gain_right);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 v = _mm512_loadu_ps(val + i);
+        __m512 first = _mm512_permutexvar_ps(first_index, v), second = _mm512_permutexvar_ps(second_index, v);
+        _mm512_storeu_ps(out + 2 * i, _mm512_add_ps(_mm512_loadu_ps(out + 2 * i), _mm512_mul_ps(first, gain)));
+        _mm512_storeu_ps(out + 2 * i + 16,
+                         _mm512_add_ps(_mm512_loadu_ps(out + 2 * i + 16), _mm512_mul_ps(second, gain)));
+    }
+    mix_scalar(out + 2 * i, val + i, n - i, gain_left, gain_right);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void to_short_avx512(int16_t *out, const float *in, int n)
+{
+    const __m512 scale = _mm512_set1_ps(32767.5f), low = _mm512_set1_ps(-40000.0f), high = _mm512_set1_ps(40000.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 a = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + i), scale), low), high);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm512_cvtsepi32_epi16(_mm512_cvttps_epi32(a)));
+    }
+    to_short_scalar(out + i, in + i, n - i);
+}
+
+// The whole group in one register of doubles per field
+__attribute__((target("avx512f,avx512vl,avx2"))) static void bank_render_avx512(SynthBank *b, int first,
+                                                                               const int16_t *samples, int frames,
+                                                                               float *out)
+{
+    const __m256 one = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(1.0f / 32767.0f);
+    const __m256i lane_one = _mm256_set1_epi32(1), zero = _mm256_setzero_si256();
+    __m512d position = _mm512_loadu_pd(b->position + first), step = _mm512_loadu_pd(b->step + first);
+    __m512d end = _mm512_loadu_pd(b->end + first), loop_end = _mm512_loadu_pd(b->loop_end + first);
+    __m512d loop_length = _mm512_loadu_pd(b->loop_length + first);
+    __m512d a0 = _mm512_loadu_pd(b->a0 + first), a1 = _mm512_loadu_pd(b->a1 + first);
+    __m512d b1 = _mm512_loadu_pd(b->b1 + first), b2 = _mm512_loadu_pd(b->b2 + first);
+    __m512d z1 = _mm512_loadu_pd(b->z1 + first), z2 = _mm512_loadu_pd(b->z2 + first);
+    __m256i offset = _mm256_loadu_si256((const __m256i *)(b->offset + first));
+    __m256i wrap_at = _mm256_loadu_si256((const __m256i *)(b->wrap_at + first));
+    __m256i loop_start = _mm256_loadu_si256((const __m256i *)(b->loop_start + first));
+    __mmask8 live = _mm256_cmpneq_epi32_mask(_mm256_loadu_si256((const __m256i *)(b->active + first)), zero);
+    __mmask8 filtered = _mm256_cmpneq_epi32_mask(_mm256_loadu_si256((const __m256i *)(b->filtered + first)), zero);
+    __m256 gain_left = _mm256_loadu_ps(b->gain_left + first), gain_right = _mm256_loadu_ps(b->gain_right + first);
+
+    for (int t = 0; t < frames; t++)
+    {
+        __mmask8 act = _mm512_mask_cmp_pd_mask(live, position, end, _CMP_LT_OQ);
+        if (!act)
+            break;
+
+        __m256i pos = _mm512_cvttpd_epi32(position), next = _mm256_add_epi32(pos, lane_one);
+        __mmask8 wrap = _mm256_mask_cmpge_epi32_mask(act, next, wrap_at);
+        __m256 alpha = _mm512_cvtpd_ps(_mm512_sub_pd(position, _mm512_cvtepi32_pd(pos)));
+        // Each 32-bit gather brings a sample with its successor; only lanes
+        // wrapping to the loop start need a second one
+        __m256i pairs = _mm256_mmask_i32gather_epi32(zero, act, _mm256_add_epi32(offset, pos), samples, 2);
+        __m256i lo = _mm256_srai_epi32(_mm256_slli_epi32(pairs, 16), 16), hi = _mm256_srai_epi32(pairs, 16);
+        if (wrap)
+        {
+            __m256i wrapped = _mm256_mmask_i32gather_epi32(zero, wrap, _mm256_add_epi32(offset, loop_start), samples, 2);
+            hi = _mm256_mask_mov_epi32(hi, wrap, _mm256_srai_epi32(_mm256_slli_epi32(wrapped, 16), 16));
+        }
+        __m256 val = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), _mm256_sub_ps(one, alpha)),
+                                                 _mm256_mul_ps(_mm256_cvtepi32_ps(hi), alpha)),
+                                   scale);
+
+        __mmask8 run_filter = act & filtered;
+        if (run_filter)
+        {
+            __m512d in = _mm512_cvtps_pd(val);
+            __m512d filtered_out = _mm512_add_pd(_mm512_mul_pd(in, a0), z1);
+            z1 = _mm512_mask_sub_pd(z1, run_filter, _mm512_add_pd(_mm512_mul_pd(in, a1), z2),
+                                    _mm512_mul_pd(b1, filtered_out));
+            z2 = _mm512_mask_sub_pd(z2, run_filter, _mm512_mul_pd(in, a0), _mm512_mul_pd(b2, filtered_out));
+            val = _mm256_mask_mov_ps(val, run_filter, _mm512_cvtpd_ps(filtered_out));
+        }
+        val = _mm256_maskz_mov_ps(act, val);
+
+        __m256 sums = _mm256_hadd_ps(_mm256_mul_ps(val, gain_left), _mm256_mul_ps(val, gain_right));
+        __m128 halves = _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1));
+        halves = _mm_hadd_ps(halves, halves);
+        _mm_storel_pi((__m64 *)(out + 2 * t),
+                      _mm_add_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)(out + 2 * t)), halves));
+
+        position = _mm512_mask_add_pd(position, act, position, step);
+        __mmask8 over = _mm512_mask_cmp_pd_mask(act, position, loop_end, _CMP_GE_OQ);
+        position = _mm512_mask_sub_pd(position, over, position, loop_length);
+    }
+
+    _mm512_storeu_pd(b->position + first, position);
+    _mm512_storeu_pd(b->z1 + first, z1);
+    _mm512_storeu_pd(b->z2 + first, z2);
+}
+
+static const SynthKernels kernels_avx512 = {"avx512", interpolate_avx512, mix_avx512, to_short_avx512,
+                                            bank_render_avx512};
+
+#endif
+
+const SynthKernels *synth_kernels_get(int level)
+{
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    switch (level)
+    {
+    case SYNTH_KERNELS_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                       __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2")
+                   ? &kernels_avx512
+                   : NULL;
+    case SYNTH_KERNELS_AVX2:
+        return __builtin_cpu_supports("avx2") ? &kernels_avx2 : NULL;
+    case SYNTH_KERNELS_SSE2:
+        return __builtin_cpu_supports("sse2") ? &kernels_sse2 : NULL;
+    }
+#endif
+    return level == SYNTH_KERNELS_SCALAR ? &kernels_scalar : NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef SYNTH_KERNELS_H
+#define SYNTH_KERNELS_H
+
+#include <stdint.h>
+
+// Inner loops of the synth renderer, one set per instruction set level
+// (SYNTH_KERNELS_* in synth.h). Internal to synth.c.
+
+// Voices per lane group of the bank engine: eight doubles fill an AVX-512
+// register
+#define SYNTH_BANK_LANES 8
+
+// Audio-rate state of the bank engine, one array per field, indexed by
+// voice slot and padded to whole lane groups. Positions count from the
+// region start at offset in the pool. Past wrap_at - 1 the next sample is
+// loop_start, and positions at or past loop_end move back by loop_length;
+// without a loop wrap_at is INT32_MAX and loop_end infinite.
+typedef struct
+{
+    double *position, *step, *end, *loop_end, *loop_length;
+    double *a0, *a1, *b1, *b2, *z1, *z2; // lowpass, used where filtered
+    int32_t *offset, *wrap_at, *loop_start;
+    int32_t *active, *filtered;          // active lanes render this block
+    float *gain_left, *gain_right;
+} SynthBank;
+
+typedef struct
+{
+    const char *name;
+    // Writes n interpolated samples, scaled to -1..1, taken at
+    // position + k * step for k < n. Every index and index + 1 must lie
+    // inside input. NULL for the scalar set, which steps positions by
+    // repeated addition inside the renderer.
+    void (*interpolate)(const int16_t *input, double position, double step, int n, float *out);
+    // Adds val, panned by the two gains, to interleaved stereo out
+    void (*mix)(float *out, const float *val, int n, float gain_left, float gain_right);
+    // Converts n mixed samples to 16-bit with saturation
+    void (*to_short)(int16_t *out, const float *in, int n);
+    // Renders frames of the active lanes in the group starting at first and
+    // adds them to interleaved stereo out. Lanes stop at their end.
+    void (*bank_render)(SynthBank *bank, int first, const int16_t *samples, int frames, float *out);
+} SynthKernels;
+
+// The set for level, or NULL if this CPU or build cannot run it
+const SynthKernels *synth_kernels_get(int level);
+
+#endif
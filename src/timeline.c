@@ -0,0 +1,148 @@
+#include "timeline.h"
+#include <stdlib.h>
+
+void timeline_init(Timeline *tl)
+{
+    tl->events = NULL;
+    tl->event_count = 0;
+    tl->event_cap = 0;
+    tl->frame_count = 0;
+    tl->oom = 0;
+}
+
+void timeline_free(Timeline *tl)
+{
+    free(tl->events);
+    timeline_init(tl);
+}
+
+static NoteEvent *timeline_push(Timeline *tl)
+{
+    if (tl->oom)
+        return NULL;
+    if (tl->event_count == tl->event_cap)
+    {
+        size_t new_cap = tl->event_cap ? tl->event_cap * 2 : 256;
+        NoteEvent *grown = realloc(tl->events, new_cap * sizeof(NoteEvent));
+        if (!grown)
+        {
+            tl->oom = 1;
+            return NULL;
+        }
+        tl->events = grown;
+        tl->event_cap = new_cap;
+    }
+    return &tl->events[tl->event_count++];
+}
+
+void timeline_note_on(Timeline *tl, size_t frame, int channel, int preset, int note, float velocity)
+{
+    NoteEvent *ev = timeline_push(tl);
+    if (!ev)
+        return;
+    ev->frame = (uint32_t)frame;
+    ev->type = EVENT_NOTE_ON;
+    ev->channel = (uint8_t)channel;
+    ev->preset = (uint8_t)preset;
+    ev->note = (uint8_t)note;
+    ev->velocity = velocity;
+}
+
+void timeline_note_off(Timeline *tl, size_t frame, int channel, int note)
+{
+    NoteEvent *ev = timeline_push(tl);
+    if (!ev)
+        return;
+    ev->frame = (uint32_t)frame;
+    ev->type = EVENT_NOTE_OFF;
+    ev->channel = (uint8_t)channel;
+    ev->preset = 0;
+    ev->note = (uint8_t)note;
+    ev->velocity = 0.0f;
+}
+
+void timeline_prefetch(sh_encoder *enc, const Timeline *tl)
+{
+    // One request per distinct channel/preset/note
+    uint8_t *seen = calloc(16 * 128 * 128 / 8, 1);
+    if (!seen)
+        return;
+    for (size_t i = 0; i < tl->event_count; i++)
+    {
+        const NoteEvent *ev = &tl->events[i];
+        if (ev->type != EVENT_NOTE_ON || ev->channel >= 16 || ev->preset >= 128 || ev->note >= 128)
+            continue;
+        size_t bit = ((size_t)ev->channel * 128 + ev->preset) * 128 + ev->note;
+        if (seen[bit / 8] & (1 << (bit % 8)))
+            continue;
+        seen[bit / 8] |= 1 << (bit % 8);
+        audio_prefetch(enc, ev->channel, ev->preset, ev->note);
+    }
+    free(seen);
+}
+
+static void apply_events(sh_encoder *enc, const Timeline *tl, size_t *next, size_t frame)
+{
+    for (; *next < tl->event_count && tl->events[*next].frame <= frame; (*next)++)
+    {
+        const NoteEvent *ev = &tl->events[*next];
+        if (ev->type == EVENT_NOTE_ON)
+            audio_note_on(enc, ev->channel, ev->preset, ev->note, ev->velocity);
+        else
+            audio_note_off(enc, ev->channel, ev->note);
+    }
+}
+
+// End of the event-free span starting at frame
+static size_t span_end(const Timeline *tl, size_t next)
+{
+    size_t end = next < tl->event_count ? tl->events[next].frame : tl->frame_count;
+    return end > tl->frame_count ? tl->frame_count : end;
+}
+
+void timeline_render_into(sh_encoder *enc, const Timeline *tl, int16_t *buffer)
+{
+    // Nothing changes until the next event, so each span is one render call
+    size_t frame = 0;
+    size_t next = 0;
+    while (frame < tl->frame_count)
+    {
+        apply_events(enc, tl, &next, frame);
+        size_t end = span_end(tl, next);
+        audio_render_samples(enc, buffer + frame * 2, end - frame);
+        frame = end;
+    }
+}
+
+int timeline_render(sh_encoder *enc, const Timeline *tl, TimelineWriteFn write, void *ctx)
+{
+    int16_t *block = malloc(TIMELINE_BLOCK_FRAMES * 2 * sizeof(int16_t));
+    if (!block)
+        return 0;
+
+    int ok = 1;
+    size_t frame = 0;
+    size_t next = 0;
+    while (frame < tl->frame_count)
+    {
+        apply_events(enc, tl, &next, frame);
+
+        // The synth starts a new effect block with every render call, so
+        // spans longer than a block are cut whole blocks from where the span
+        // starts; the effect blocks then fall as in timeline_render_into()
+        size_t end = span_end(tl, next);
+        while (frame < end)
+        {
+            size_t n = TIMELINE_BLOCK_FRAMES;
+            if (n > end - frame)
+                n = end - frame;
+            audio_render_samples(enc, block, n);
+            if (ok && !write(ctx, block, n))
+                ok = 0;
+            frame += n;
+        }
+    }
+
+    free(block);
+    return ok;
+}
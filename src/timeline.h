@@ -0,0 +1,61 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "audio.h"
+
+enum
+{
+    EVENT_NOTE_ON,
+    EVENT_NOTE_OFF
+};
+
+// One synth event, placed at an exact frame of the track
+typedef struct
+{
+    uint32_t frame;
+    uint8_t type;
+    uint8_t channel;
+    uint8_t preset; // note-on only
+    uint8_t note;
+    float velocity; // note-on only
+} NoteEvent;
+
+// A composed track: events in playing order (events on the same frame keep
+// the order they were added in) and the total length in frames.
+typedef struct
+{
+    NoteEvent *events;
+    size_t event_count;
+    size_t event_cap;
+    size_t frame_count;
+    int oom;
+} Timeline;
+
+void timeline_init(Timeline *tl);
+void timeline_free(Timeline *tl);
+// Appending never fails outright; an allocation failure sets tl->oom and
+// drops the rest of the events, so callers check once at the end.
+void timeline_note_on(Timeline *tl, size_t frame, int channel, int preset, int note, float velocity);
+void timeline_note_off(Timeline *tl, size_t frame, int channel, int note);
+
+// Prefetches the samples of every instrument and note tl plays, so they are
+// read in ahead of rendering instead of at their first note-on
+void timeline_prefetch(sh_encoder *enc, const Timeline *tl);
+
+// Receives rendered PCM in order; returns 0 to report a write error
+typedef int (*TimelineWriteFn)(void *ctx, const int16_t *pcm, size_t frames);
+
+// Plays tl through enc into buffer (tl->frame_count stereo frames), with one
+// render call per event-free span.
+void timeline_render_into(sh_encoder *enc, const Timeline *tl, int16_t *buffer);
+
+// Same, but hands the PCM to write() in blocks of at most
+// TIMELINE_BLOCK_FRAMES, cut from the start of each event-free span, so the
+// output matches timeline_render_into(). A multiple of the synth's 1024-frame
+// render block and so of AUDIO_EFFECT_BLOCK_FRAMES.
+#define TIMELINE_BLOCK_FRAMES 8192
+int timeline_render(sh_encoder *enc, const Timeline *tl, TimelineWriteFn write, void *ctx);
+
+#endif
@@ -0,0 +1,133 @@
+#define TSF_IMPLEMENTATION
+#include "tsf.h"
+#include "audio.h"
+#include "encode.h"
+#include "timeline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One-off parity check (make tsfcheck): plays composed tracks through
+// TinySoundFont, which stringheat rendered with before src/synth.c, and
+// through the embedded font, and reports how far apart the two are. TSF
+// loads the SF2 the embedded image was built from. Both sides render every
+// voice to its end without a polyphony cap, as TSF did, so only synthesis
+// differences remain.
+
+static const char *check_texts[] = {
+    "the quick brown fox jumps over the lazy dog",
+    "all work and no play makes a dull song",
+    "meet me at the old bridge when the bells ring twice",
+    "somewhere over the rainbow way up high",
+};
+#define CHECK_TEXT_COUNT 4
+
+// Plays tl through TSF the way audio.c drove it: one render call per
+// event-free span, drums from bank 128 on channel 9
+static void render_tsf(tsf *synth, const Timeline *tl, int16_t *buffer)
+{
+    size_t frame = 0, next = 0;
+    while (frame < tl->frame_count)
+    {
+        for (; next < tl->event_count && tl->events[next].frame <= frame; next++)
+        {
+            const NoteEvent *ev = &tl->events[next];
+            if (ev->type == EVENT_NOTE_ON)
+            {
+                tsf_channel_set_bank_preset(synth, ev->channel, ev->channel == 9 ? 128 : 0, ev->preset);
+                tsf_channel_note_on(synth, ev->channel, ev->note, ev->velocity);
+            }
+            else
+                tsf_channel_note_off(synth, ev->channel, ev->note);
+        }
+        size_t end = next < tl->event_count ? tl->events[next].frame : tl->frame_count;
+        if (end > tl->frame_count)
+            end = tl->frame_count;
+        tsf_render_short(synth, buffer + frame * 2, (int)(end - frame), 0);
+        frame = end;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: tsfcheck <font.sf2> [tracks]\n");
+        return 1;
+    }
+    int tracks = argc > 2 ? atoi(argv[2]) : CHECK_TEXT_COUNT;
+
+    tsf *reference = tsf_load_filename(argv[1]);
+    AudioOptions options = {NULL, 0, 4096, AUDIO_CULL_OFF, AUDIO_ENGINE_VOICES};
+    sh_engine *engine = audio_init_with(&options);
+    sh_encoder *enc = audio_encoder_create(engine);
+    if (!reference || !enc)
+    {
+        fprintf(stderr, "Error: Cannot load '%s' or the embedded font\n", reference ? "embedded font" : argv[1]);
+        return 1;
+    }
+    tsf_set_output(reference, TSF_STEREO_INTERLEAVED, 44100, 0.0f);
+
+    int ok = 1;
+    size_t total_samples = 0, total_differing = 0;
+    int total_max = 0;
+    double total_signal = 0.0, total_noise = 0.0;
+    printf("%-6s %10s %10s %8s %10s %9s\n", "track", "samples", "differ", "max", "RMS", "SNR");
+    for (int t = 0; ok && t < tracks; t++)
+    {
+        char seed[32];
+        snprintf(seed, sizeof(seed), "bench%d", t);
+        Timeline tl;
+        timeline_init(&tl);
+        ok = encode_compile(check_texts[t % CHECK_TEXT_COUNT], seed, &tl);
+        int16_t *pcm[2] = {ok ? calloc(tl.frame_count * 2, sizeof(int16_t)) : NULL,
+                           ok ? calloc(tl.frame_count * 2, sizeof(int16_t)) : NULL};
+        ok = ok && pcm[0] && pcm[1];
+        if (ok)
+        {
+            tsf_reset(reference);
+            render_tsf(reference, &tl, pcm[0]);
+            audio_encoder_reset(enc);
+            timeline_render_into(enc, &tl, pcm[1]);
+
+            size_t samples = tl.frame_count * 2, differing = 0;
+            int max_diff = 0;
+            double signal = 0.0, noise = 0.0;
+            for (size_t i = 0; i < samples; i++)
+            {
+                int diff = abs(pcm[1][i] - pcm[0][i]);
+                differing += diff != 0;
+                if (diff > max_diff)
+                    max_diff = diff;
+                signal += (double)pcm[0][i] * pcm[0][i];
+                noise += (double)diff * diff;
+            }
+            printf("%-6d %10zu %10zu %8d %10.2f %6.1f dB\n", t, samples, differing, max_diff,
+                   sqrt(noise / samples), noise > 0 ? 10.0 * log10(signal / noise) : INFINITY);
+            total_samples += samples;
+            total_differing += differing;
+            if (max_diff > total_max)
+                total_max = max_diff;
+            total_signal += signal;
+            total_noise += noise;
+        }
+        free(pcm[0]);
+        free(pcm[1]);
+        timeline_free(&tl);
+    }
+    if (ok && total_samples)
+        printf("%-6s %10zu %10zu %8d %10.2f %6.1f dB\n", "all", total_samples, total_differing, total_max,
+               sqrt(total_noise / total_samples),
+               total_noise > 0 ? 10.0 * log10(total_signal / total_noise) : INFINITY);
+
+    audio_encoder_destroy(enc);
+    audio_cleanup(engine);
+    tsf_close(reference);
+    if (!ok)
+    {
+        fprintf(stderr, "Error: Rendering failed\n");
+        return 1;
+    }
+    return 0;
+}